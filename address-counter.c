@@ -8,74 +8,391 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <memory.h>
+#include <string.h>
 #include <err.h>
-#include <sys/types.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
+#include <pthread.h>
+
+#include "parse.h"
+#include "input.h"
 
 /*
- * Counts IPv4 addresses
+ * Counts IPv4 addresses, or the prefixes they fall in.
+ *
+ * The counters are a two-level radix array: one entry per /16, for the
+ * addresses (or prefixes) in that /16.  An entry starts out as a small
+ * open-addressing table of (address, count) slots, and once that is an
+ * eighth full it is replaced by a dense page with a counter for every
+ * address in the /16.  So sparse input costs a few bytes per address and
+ * dense input a plain array index.
+ *
+ * Dense pages are counted with atomic adds and tables under a lock per
+ * entry, so any number of threads can share them and the input can be
+ * split anywhere between lines.  Output comes out in address order by
+ * walking the entries.
  */
 
-struct _item {
-	struct in_addr a;
-	unsigned int c;
-	struct _item *next;
+#define TOP_BITS 16
+#define SLOTS_MIN 16
+
+int debug = 0;
+
+struct slot {
+	unsigned int key;	/* low bits of the key, plus one; 0 is empty */
+	unsigned int count;
+};
+
+struct entry {
+	unsigned int *dense;
+	struct slot *slots;
+	unsigned int nslots;
+	unsigned int nused;
+	pthread_mutex_t lock;
 };
-typedef struct _item item;
 
-item *array[65536];
+static struct entry *entries[1 << TOP_BITS];
+static int prefix_len = 32;		/* -p */
+static int page_bits = 16;		/* log2 of counters per dense page */
+static int jobs = 1;			/* -j */
+static unsigned long skipped = 0;	/* unparseable lines */
+
+struct piece {
+	const char *start;
+	const char *end;
+	unsigned long skipped;
+};
+
+static struct entry *
+entry(unsigned int top)
+{
+	struct entry *e = __atomic_load_n(&entries[top], __ATOMIC_ACQUIRE);
+	struct entry *expect = NULL;
+	if (e)
+		return e;
+	e = calloc(1, sizeof(*e));
+	if (NULL == e)
+		err(1, "calloc");
+	pthread_mutex_init(&e->lock, NULL);
+	if (__atomic_compare_exchange_n(&entries[top], &expect, e, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return e;
+	pthread_mutex_destroy(&e->lock);	/* another thread got there first */
+	free(e);
+	return expect;
+}
+
+static struct slot *
+slot_find(struct slot *slots, unsigned int nslots, unsigned int key)
+{
+	unsigned int h = (key * 2654435761U) & (nslots - 1);
+	while (slots[h].key && slots[h].key != key)
+		h = (h + 1) & (nslots - 1);
+	return &slots[h];
+}
+
+/*
+ * Give the entry more slots, or a dense page once the slots would take
+ * more than an eighth of one
+ */
+static void
+entry_grow(struct entry *e)
+{
+	size_t size = (size_t)1 << page_bits;
+	struct slot *old = e->slots;
+	unsigned int n = e->nslots;
+	unsigned int i;
+	if ((size_t)n * 2 * sizeof(*old) > size * sizeof(*e->dense) / 8) {
+		unsigned int *d = calloc(size, sizeof(*d));
+		if (NULL == d)
+			err(1, "calloc");
+		for (i = 0; i < n; i++)
+			if (old[i].key)
+				d[old[i].key - 1] = old[i].count;
+		__atomic_store_n(&e->dense, d, __ATOMIC_RELEASE);
+		e->slots = NULL;
+		e->nslots = 0;
+		free(old);
+		return;
+	}
+	e->nslots = n ? n * 2 : SLOTS_MIN;
+	e->slots = calloc(e->nslots, sizeof(*e->slots));
+	if (NULL == e->slots)
+		err(1, "calloc");
+	for (i = 0; i < n; i++)
+		if (old[i].key)
+			*slot_find(e->slots, e->nslots, old[i].key) = old[i];
+	free(old);
+}
+
+/*
+ * Add 'n' to the count of 'key'.  A count of 0 adds nothing, and must not
+ * make a slot either, or the address would be printed with a 0 count that
+ * a dense page would not print.
+ */
+static void
+count(unsigned int key, unsigned int n)
+{
+	struct entry *e;
+	unsigned int low = key & ((1U << page_bits) - 1);
+	unsigned int *d;
+	struct slot *s;
+	if (0 == n)
+		return;
+	e = entry(key >> page_bits);
+	d = __atomic_load_n(&e->dense, __ATOMIC_ACQUIRE);
+	if (NULL == d && jobs > 1) {
+		pthread_mutex_lock(&e->lock);
+		d = e->dense;
+		if (d)
+			pthread_mutex_unlock(&e->lock);
+	}
+	if (d) {
+		if (jobs > 1)
+			__atomic_fetch_add(&d[low], n, __ATOMIC_RELAXED);
+		else
+			d[low] += n;
+		return;
+	}
+	if (4 * (e->nused + 1) > 3 * e->nslots)
+		entry_grow(e);
+	if (e->dense) {
+		__atomic_fetch_add(&e->dense[low], n, __ATOMIC_RELAXED);
+	} else {
+		s = slot_find(e->slots, e->nslots, low + 1);
+		if (0 == s->key) {
+			s->key = low + 1;
+			e->nused++;
+		}
+		s->count += n;
+	}
+	if (jobs > 1)
+		pthread_mutex_unlock(&e->lock);
+}
 
-static item *
-find(struct in_addr a, int new)
+/*
+ * A line may carry a count after the address, as this program prints
+ * them, in which case that is added instead of 1.  So counts can be merged,
+ * or counted again into shorter prefixes.  Lines with a prefix or range
+ * of addresses are skipped, as they have no one address to count.
+ */
+static void *
+count_lines(void *arg)
 {
-	unsigned int b = ntohl(a.s_addr) >> 16;
-	item **I;
-	item *i;
-	for (I = &array[b]; *I; I=&(*I)->next)
-		if ((*I)->a.s_addr == a.s_addr) {
-			i = *I;
-			if (i != array[b]) {
-				/* move to top */
-				*I = i->next;
-				i->next = array[b];
-				array[b] = i;
+	struct piece *w = arg;
+	const char *p = w->start;
+	while (p < w->end) {
+		struct input_line r;
+		const char *t;
+		int tlen;
+		const char *eol = memchr(p, '\n', w->end - p);
+		if (NULL == eol)
+			eol = w->end;
+		switch (parse_line(p, eol, 0, &r, &t, &tlen)) {
+		case PARSE_OK:
+			if (r.last != r.addr) {
+				w->skipped++;
+				break;
 			}
-			return i;
+			count(prefix_len ? r.addr >> (32 - prefix_len) : 0,
+			    r.value < 0 ? 1 : r.value);
+			break;
+		case PARSE_EMPTY:
+			break;
+		default:
+			w->skipped++;
+			break;
 		}
-	if (!new)
-		return NULL;
-	i = calloc(1, sizeof(*i));
-	if (NULL == i)
-		err(1, "malloc");
-	i->a = a;
-	i->next = array[b];
-	array[b] = i;
-	return i;
+		p = eol + 1;
+	}
+	return NULL;
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * Count one buffer of whole lines, split into a newline-aligned piece
+ * per thread
+ */
+static void
+count_buffer(const char *buf, size_t len)
+{
+	struct piece *w = calloc(jobs, sizeof(*w));
+	pthread_t *tids = calloc(jobs, sizeof(*tids));
+	const char *p = buf;
+	int j;
+	if (NULL == w || NULL == tids)
+		err(1, "calloc");
+	for (j = 0; j < jobs; j++) {
+		const char *e = buf + len * (j + 1) / jobs;
+		if (e < p)
+			e = p;
+		while (e < buf + len && e > buf && '\n' != e[-1])
+			e++;
+		w[j].start = p;
+		w[j].end = e;
+		p = e;
+		if (1 == jobs)
+			count_lines(&w[j]);
+		else if (0 != pthread_create(&tids[j], NULL, count_lines, &w[j]))
+			errx(1, "cannot start counting thread");
+	}
+	for (j = 0; j < jobs; j++) {
+		if (jobs > 1)
+			pthread_join(tids[j], NULL);
+		skipped += w[j].skipped;
+	}
+	free(w);
+	free(tids);
+}
+
+static void
+print(unsigned int key, unsigned int count)
+{
+	unsigned int a = prefix_len ? key << (32 - prefix_len) : 0;
+	printf("%u.%u.%u.%u\t%u\n", a >> 24, (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff, count);
+}
+
+struct item {
+	unsigned int key;
+	unsigned int count;
+};
+
+static int
+by_key(const void *a, const void *b)
+{
+	const struct item *x = a;
+	const struct item *y = b;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int
+by_count(const void *a, const void *b)
+{
+	const struct item *x = a;
+	const struct item *y = b;
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return by_key(a, b);
+}
+
+struct items {
+	struct item *v;
+	size_t n;
+	size_t max;
+};
+
+static void
+items_add(struct items *l, unsigned int key, unsigned int count)
+{
+	if (l->n == l->max) {
+		l->max = l->max ? l->max * 2 : 65536;
+		l->v = realloc(l->v, l->max * sizeof(*l->v));
+		if (NULL == l->v)
+			err(1, "realloc");
+	}
+	l->v[l->n].key = key;
+	l->v[l->n].count = count;
+	l->n++;
+}
+
+/*
+ * Print every nonzero counter, in address order or (-c) largest first
+ */
+static void
+output(int sort_by_count)
 {
-	char buf[128];
-	unsigned int b;
-	while (NULL != fgets(buf, sizeof(buf), stdin)) {
-		struct in_addr a;
-		item *i;
-		strtok(buf, "\r\n");
-		if (1 != inet_pton(AF_INET, buf, &a))
+	unsigned int ntop = 1U << (prefix_len - page_bits);
+	unsigned int size = 1U << page_bits;
+	struct items all;
+	struct items one;
+	unsigned int t;
+	size_t i;
+	memset(&all, 0, sizeof(all));
+	memset(&one, 0, sizeof(one));
+	for (t = 0; t < ntop; t++) {
+		struct entry *e = entries[t];
+		struct items *l = sort_by_count ? &all : &one;
+		if (NULL == e)
+			continue;
+		if (e->dense) {
+			for (i = 0; i < size; i++) {
+				if (0 == e->dense[i])
+					continue;
+				if (sort_by_count)
+					items_add(l, t << page_bits | i, e->dense[i]);
+				else
+					print(t << page_bits | i, e->dense[i]);
+			}
+			continue;
+		}
+		for (i = 0; i < e->nslots; i++)
+			if (e->slots[i].key)
+				items_add(l, t << page_bits | (e->slots[i].key - 1), e->slots[i].count);
+		if (sort_by_count)
 			continue;
-		i = find(a, 1);
-		i->c++;
+		qsort(one.v, one.n, sizeof(*one.v), by_key);
+		for (i = 0; i < one.n; i++)
+			print(one.v[i].key, one.v[i].count);
+		one.n = 0;
 	}
-	for (b = 0; b<65536; b++) {
-		item *i;
-		for (i = array[b]; i; i=i->next) {
-			if (NULL == inet_ntop(AF_INET, &i->a, buf, 128))
-				continue;
-			printf("%s\t%u\n", buf, i->c);
+	free(one.v);
+	if (!sort_by_count)
+		return;
+	qsort(all.v, all.n, sizeof(*all.v), by_count);
+	for (i = 0; i < all.n; i++)
+		print(all.v[i].key, all.v[i].count);
+	free(all.v);
+}
+
+static void
+usage(const char *argv0)
+{
+	const char *t = strrchr(argv0, '/');
+	printf("usage: %s [-c] [-j threads] [-p len] [file ...] < iplist\n", t ? t + 1 : argv0);
+	printf("\t-c         sort by count, largest first, not by address\n");
+	printf("\t-j num     threads for counting\n");
+	printf("\t-p len     count /len prefixes, printed as their first address\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int sort_by_count = 0;
+	int ch;
+	int f = 0;
+	while ((ch = getopt(argc, argv, "cj:p:")) != -1) {
+		switch (ch) {
+		case 'c':
+			sort_by_count = 1;
+			break;
+		case 'j':
+			jobs = strtol(optarg, NULL, 10);
+			if (jobs < 1)
+				errx(1, "-j needs at least one thread");
+			break;
+		case 'p':
+			prefix_len = strtol(optarg, NULL, 10);
+			if (prefix_len < 0 || prefix_len > 32)
+				errx(1, "-p prefix length must be 0 to 32");
+			break;
+		default:
+			usage(argv[0]);
+			break;
 		}
 	}
+	argc -= optind;
+	argv += optind;
+	page_bits = prefix_len > TOP_BITS ? prefix_len - TOP_BITS : 0;
+
+	do {
+		struct input in;
+		const char *buf;
+		size_t len;
+		input_open(&in, argc ? argv[f] : NULL, input_complete_lines);
+		while (input_next(&in, &buf, &len))
+			count_buffer(buf, len);
+		input_close(&in);
+	} while (++f < argc);
+	if (skipped)
+		warnx("skipped %lu lines without a single address", skipped);
+	output(sort_by_count);
 	return 0;
 }
@@ -26,6 +26,11 @@
  */
 #define FONT_ALPHA 75
 
+/*
+ * The sublabel can hang below the prefix's box by this much
+ */
+#define LABEL_MARGIN 32
+
 int annotateColor = -1;
 
 
@@ -38,9 +43,13 @@ annotate_cidr(gdImagePtr image, const char *cidr, const char *label, const char
 {
     bbox box = bbox_from_cidr(cidr);
     if (box.xmin < 0) {
-	fprintf(stderr, "Warning: annotation %s is out of range for this image\n", cidr);
+	if (!bbox_view.quiet)
+	    fprintf(stderr, "Warning: annotation %s is out of range for this image\n", cidr);
 	return;
     }
+    box = bbox_in_view(box);
+    if (!bbox_visible(box, image, LABEL_MARGIN))
+	return;
     bbox_draw_outline(box, image, annotateColor);
     text_in_bbox(image, label, box, annotateColor, 128.0);
     if (sublabel) {
@@ -70,8 +79,6 @@ annotate_file(gdImagePtr image, const char *fn)
 	else 
 	    annotateColor = gdImageColorAllocateAlpha(image, 255, 255, 255, FONT_ALPHA);
     }
-    if (!gdFTUseFontConfig(1))
-	warnx("fontconfig not available");
     while (NULL != fgets(buf, 512, fp)) {
 	char *cidr;
 	char *label;
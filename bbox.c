@@ -28,6 +28,8 @@
 #define MAX(a,b) (a>b?a:b)
 #endif
 
+struct bbox_view bbox_view = { 0, 0, 0, 0 };
+
 
 void
 bbox_draw_outline(bbox box, gdImagePtr image, int color)
@@ -44,71 +46,110 @@ bbox_draw_outline(bbox box, gdImagePtr image, int color)
     gdImagePolygon(image, points, 4, color);
 }
 
+/*
+ * Fill the box by writing its rows straight into the image, clipped to the
+ * image.  Like gd's own drawing, a translucent color is blended into a
+ * true color image when blending is on.
+ */
 void
-bbox_draw_filled(bbox box, gdImagePtr image, int color)
+bbox_fill(bbox box, gdImagePtr image, int color)
 {
-    gdPoint points[4];
-    points[0].x = box.xmin;
-    points[1].x = box.xmax;
-    points[2].x = box.xmax;
-    points[3].x = box.xmin;
-    points[0].y = box.ymin;
-    points[1].y = box.ymin;
-    points[2].y = box.ymax;
-    points[3].y = box.ymax;
-    gdImageFilledPolygon(image, points, 4, color);
+    int blend = gdImageTrueColor(image) && image->alphaBlendingFlag
+	&& gdTrueColorGetAlpha(color) != gdAlphaOpaque;
+    int x;
+    int y;
+    box.xmin = MAX(box.xmin, 0);
+    box.ymin = MAX(box.ymin, 0);
+    box.xmax = MIN(box.xmax, gdImageSX(image) - 1);
+    box.ymax = MIN(box.ymax, gdImageSY(image) - 1);
+    for (y = box.ymin; y <= box.ymax; y++) {
+	if (!gdImageTrueColor(image)) {
+	    if (box.xmin <= box.xmax)
+		memset(image->pixels[y] + box.xmin, color, box.xmax - box.xmin + 1);
+	    continue;
+	}
+	for (x = box.xmin; x <= box.xmax; x++) {
+	    int *p = &image->tpixels[y][x];
+	    *p = blend ? gdAlphaBlend(*p, color) : color;
+	}
+    }
 }
 
 /*
- * Find the "bounding box" for the IPv4 netblock starting at 'first' and having
- * 'slash' netmask bits.
- * 
- * For square areas this is pretty easy.  We know how to find the point diagonally
- * opposite the first value (add 1010..1010). Its a little harder for
- * rectangular areas, so I cheat a little and divide it into the two smaller
- * squares.
+ * Addresses along the curve are counted in cells of 4^shift grid cells.
+ * An aligned run of 4^k cells is a square of 2^k by 2^k, on both the
+ * Hilbert and Morton curves, and an aligned run of 2 x 4^k cells is two
+ * such squares side by side.  So any range of addresses is exactly the
+ * union of the aligned runs it splits into, at most two of each size.
  */
 static bbox
-bounding_box(unsigned int first, int slash)
+block_square(unsigned long long s, int side_bits)
 {
     bbox box;
-    unsigned int diag = 0xAAAAAAAA;
-    if (morton_flag)
-	diag = 0xFFFFFFFF;
-    unsigned int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    unsigned int x;
+    unsigned int y;
+    unsigned int mask = ~((1U << side_bits) - 1);
+    xy_from_ip(addr_space_first_addr + ((unsigned int)s << addr_space_bits_per_pixel), &x, &y);
+    box.xmin = x & mask;
+    box.ymin = y & mask;
+    box.xmax = box.xmin + (1 << side_bits) - 1;
+    box.ymax = box.ymin + (1 << side_bits) - 1;
+    return box;
+}
 
-    if (slash > 31) {
-	/*
-	 * treat /32 as a special case
-	 */
-	xy_from_ip(first, &x1, &y1);
-	box.xmin = x1;
-	box.ymin = y1;
-	box.xmax = x1;
-	box.ymax = y1;
-    } else if (0 == (slash & 1)) {
-	/*
-	 * square
-	 */
-	diag >>= slash;
-	xy_from_ip(first, &x1, &y1);
-	xy_from_ip(first + diag, &x2, &y2);
-	box.xmin = MIN(x1, x2);
-	box.ymin = MIN(y1, y2);
-	box.xmax = MAX(x1, x2);
-	box.ymax = MAX(y1, y2);
-    } else {
-	/*
-	 * rectangle: divide, conquer
-	 */
-	bbox b1 = bounding_box(first, slash + 1);
-	bbox b2 = bounding_box(first + (1 << (32 - (slash + 1))), slash + 1);
-	box.xmin = MIN(b1.xmin, b2.xmin);
-	box.ymin = MIN(b1.ymin, b2.ymin);
-	box.xmax = MAX(b1.xmax, b2.xmax);
-	box.ymax = MAX(b1.ymax, b2.ymax);
+/*
+ * Call 'fn' with the grid bounding box of each block making up the
+ * addresses from 'first' to 'last' within the rendered space.  Blocks are
+ * whole cells of 2^shift by 2^shift, so that they stay separate once moved
+ * into a view with that shift; a cell only partly in the range is
+ * included.  Returns the number of blocks.
+ */
+int
+bbox_blocks(unsigned int first, unsigned int last, int shift, bbox_block_fn fn, void *arg)
+{
+    unsigned long long s;
+    unsigned long long e;
+    int n = 0;
+    if (first > last || last < addr_space_first_addr || first > addr_space_last_addr)
+	return 0;
+    if (first < addr_space_first_addr)
+	first = addr_space_first_addr;
+    if (last > addr_space_last_addr)
+	last = addr_space_last_addr;
+    s = ((first - addr_space_first_addr) >> addr_space_bits_per_pixel) >> (2 * shift);
+    e = ((last - addr_space_first_addr) >> addr_space_bits_per_pixel) >> (2 * shift);
+    while (s <= e) {
+	int j = 0;
+	bbox box;
+	while (j < 32 && 0 == (s & ((2ULL << j) - 1)) && s + (2ULL << j) - 1 <= e)
+	    j++;
+	box = block_square(s << (2 * shift), j / 2 + shift);
+	if (j & 1) {
+	    bbox b2 = block_square((s + (1ULL << (j - 1))) << (2 * shift), j / 2 + shift);
+	    box.xmin = MIN(box.xmin, b2.xmin);
+	    box.ymin = MIN(box.ymin, b2.ymin);
+	    box.xmax = MAX(box.xmax, b2.xmax);
+	    box.ymax = MAX(box.ymax, b2.ymax);
+	}
+	fn(box, arg);
+	n++;
+	s += 1ULL << j;
     }
-    return box;
+    return n;
+}
+
+static void
+bbox_union(bbox box, void *arg)
+{
+    bbox *u = arg;
+    if (u->xmin < 0) {
+	*u = box;
+	return;
+    }
+    u->xmin = MIN(u->xmin, box.xmin);
+    u->ymin = MIN(u->ymin, box.ymin);
+    u->xmax = MAX(u->xmax, box.xmax);
+    u->ymax = MAX(u->ymax, box.ymax);
 }
 
 /*
@@ -126,8 +167,8 @@ bbox_from_cidr(const char *cidr)
 	bbox.xmin = bbox.ymin = bbox.xmax = bbox.ymax = -1;
 	return bbox;
     }
-    memset(&bbox, '\0', sizeof(bbox));
-    bbox = bounding_box(first, slash);
+    bbox.xmin = bbox.ymin = bbox.xmax = bbox.ymax = -1;
+    bbox_blocks(first, last, 0, bbox_union, &bbox);
     if (debug) {
 	char fstr[24];
 	char lstr[24];
@@ -145,3 +186,30 @@ bbox_from_cidr(const char *cidr)
     }
     return bbox;
 }
+
+/*
+ * Move a grid bounding box into the current view
+ */
+bbox
+bbox_in_view(bbox box)
+{
+    box.xmin = (box.xmin >> bbox_view.shift) - bbox_view.x0;
+    box.ymin = (box.ymin >> bbox_view.shift) - bbox_view.y0;
+    box.xmax = (box.xmax >> bbox_view.shift) - bbox_view.x0;
+    box.ymax = (box.ymax >> bbox_view.shift) - bbox_view.y0;
+    return box;
+}
+
+/*
+ * True if anything drawn within 'margin' pixels of the box can land on
+ * the image
+ */
+int
+bbox_visible(bbox box, gdImagePtr image, int margin)
+{
+    if (box.xmax + margin < 0 || box.ymax + margin < 0)
+	return 0;
+    if (box.xmin - margin >= gdImageSX(image) || box.ymin - margin >= gdImageSY(image))
+	return 0;
+    return 1;
+}
@@ -15,8 +15,25 @@ typedef struct bb bbox;
 #define BBOX_SET(B,W,X,Y,Z) B.xmin=W; B.ymin=X; B.xmax=Y; B.ymax=Z;
 #define BBOX_PRINT(B) fprintf(stderr, "%s=%d,%d,%d,%d\n", #B, B.xmin,B.ymin,B.xmax,B.ymax)
 
+/*
+ * Overlays are drawn in grid coordinates shifted right by 'shift' bits and
+ * then moved by (-x0,-y0).  The tile writer sets this to draw the same
+ * overlays onto any tile of any zoom level; normally it is all zero.
+ */
+struct bbox_view {
+    int shift;
+    int x0, y0;
+    int quiet;			/* don't repeat warnings for every tile */
+};
+extern struct bbox_view bbox_view;
+
+typedef void (*bbox_block_fn) (bbox box, void *arg);
+
 void bbox_draw_outline(bbox box, gdImagePtr image, int color);
-void bbox_draw_filled(bbox box, gdImagePtr image, int color);
+void bbox_fill(bbox box, gdImagePtr image, int color);
+int bbox_blocks(unsigned int first, unsigned int last, int shift, bbox_block_fn fn, void *arg);
 bbox bbox_from_cidr(const char *prefix);
+bbox bbox_in_view(bbox box);
+int bbox_visible(bbox box, gdImagePtr image, int margin);
 
 #endif
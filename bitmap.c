@@ -0,0 +1,257 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Bitmap of the addresses seen, for the -U unique address mode.  It is
+ * 512 MB of anonymous memory, or a mapped file that keeps it between runs
+ * (and can come from elsewhere, such as a scanner).  Bits are set in place
+ * by any number of input threads, and each pixel is colored by the number
+ * of bits set in its block of addresses.
+ *
+ * Most of a sparse bitmap is never written, so a byte per VM page records
+ * which pages can have bits set, and counting skips the others without
+ * touching them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ipv4-heatmap.h"
+#include "bitmap.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_SIMD_POPCOUNT 1
+#include <immintrin.h>
+#endif
+
+#define PAGE_BITS 15		/* addresses per 4 KB page of the bitmap */
+#define NPAGES (1U << (32 - PAGE_BITS))
+
+static uint64_t *bitmap = NULL;
+static unsigned char *touched = NULL;
+const char *bitmap_popcount_name = "c";
+
+/*
+ * Word 'i', with address 64 * i + k in bit k whatever the host byte order
+ */
+static inline uint64_t
+word(size_t i)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(bitmap[i]);
+#else
+    return bitmap[i];
+#endif
+}
+
+static unsigned long long
+popcount_words_c(const uint64_t *w, size_t n)
+{
+    unsigned long long c = 0;
+    size_t i;
+    for (i = 0; i < n; i++)
+	c += __builtin_popcountll(w[i]);
+    return c;
+}
+
+#if HAVE_SIMD_POPCOUNT
+__attribute__((target("popcnt")))
+static unsigned long long
+popcount_words_popcnt(const uint64_t *w, size_t n)
+{
+    unsigned long long c = 0;
+    size_t i;
+    for (i = 0; i < n; i++)
+	c += __builtin_popcountll(w[i]);
+    return c;
+}
+
+/*
+ * Eight words at a time; pixels of /23 or larger have whole vectors
+ */
+__attribute__((target("popcnt,avx512f,avx512vpopcntdq")))
+static unsigned long long
+popcount_words_avx512(const uint64_t *w, size_t n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    unsigned long long c = 0;
+    size_t i;
+    for (i = 0; i + 8 <= n; i += 8)
+	acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(w + i)));
+    for (; i < n; i++)
+	c += __builtin_popcountll(w[i]);
+    return c + _mm512_reduce_add_epi64(acc);
+}
+#endif
+
+static unsigned long long (*popcount_words) (const uint64_t *, size_t) = popcount_words_c;
+
+/*
+ * Map the bitmap: 'file' if given, created if need be, otherwise
+ * anonymous memory.  A file that cannot be written is mapped copy-on-write,
+ * so it can still be read and added to, without changing it.
+ */
+void
+bitmap_init(const char *file)
+{
+    void *p;
+    if (NULL == file) {
+	p = mmap(NULL, BITMAP_BYTES, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (MAP_FAILED == p)
+	    err(1, "address bitmap");
+    } else {
+	struct stat sb;
+	int shared = 1;
+	int fd = open(file, O_RDWR | O_CREAT, 0666);
+	if (fd < 0 && (EACCES == errno || EROFS == errno)) {
+	    fd = open(file, O_RDONLY);
+	    shared = 0;
+	}
+	if (fd < 0)
+	    err(1, "%s", file);
+	if (fstat(fd, &sb) < 0)
+	    err(1, "%s", file);
+	if (0 == sb.st_size && shared) {
+	    if (ftruncate(fd, BITMAP_BYTES) < 0)
+		err(1, "%s", file);
+	} else if ((size_t) sb.st_size != BITMAP_BYTES) {
+	    errx(1, "%s: not an address bitmap (%lld bytes, not %lu)", file,
+		(long long) sb.st_size, (unsigned long) BITMAP_BYTES);
+	}
+	p = mmap(NULL, BITMAP_BYTES, PROT_READ | PROT_WRITE,
+	    shared ? MAP_SHARED : MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+	if (MAP_FAILED == p)
+	    err(1, "%s", file);
+	close(fd);
+	if (sb.st_size) {
+	    touched = malloc(NPAGES);
+	    if (NULL == touched)
+		err(1, "malloc");
+	    memset(touched, 1, NPAGES);
+	}
+    }
+    bitmap = p;
+    if (NULL == touched)
+	touched = calloc(NPAGES, 1);
+    if (NULL == touched)
+	err(1, "calloc");
+#if HAVE_SIMD_POPCOUNT
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+	popcount_words = popcount_words_avx512;
+	bitmap_popcount_name = "avx512";
+    } else if (__builtin_cpu_supports("popcnt")) {
+	popcount_words = popcount_words_popcnt;
+	bitmap_popcount_name = "popcnt";
+    }
+#endif
+    if (debug)
+	fprintf(stderr, "address bitmap %s, popcount = %s\n",
+	    file ? file : "in memory", bitmap_popcount_name);
+}
+
+void
+bitmap_free(void)
+{
+    if (NULL == bitmap)
+	return;
+    munmap(bitmap, BITMAP_BYTES);
+    free(touched);
+    bitmap = NULL;
+    touched = NULL;
+}
+
+static inline void
+mark(unsigned int addr)
+{
+    if (!__atomic_load_n(&touched[addr >> PAGE_BITS], __ATOMIC_RELAXED))
+	__atomic_store_n(&touched[addr >> PAGE_BITS], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Set the bit for 'addr'.  Safe to call from several threads at once.
+ */
+void
+bitmap_set(unsigned int addr)
+{
+    unsigned char *b = (unsigned char *)bitmap + (addr >> 3);
+    unsigned char m = 1 << (addr & 7);
+    if (__atomic_load_n(b, __ATOMIC_RELAXED) & m)
+	return;			/* seen before; don't dirty the page again */
+    __atomic_fetch_or(b, m, __ATOMIC_RELAXED);
+    mark(addr);
+}
+
+void
+bitmap_set_range(unsigned int first, unsigned int last)
+{
+    unsigned char *bytes = (unsigned char *)bitmap;
+    unsigned long long a = first;
+    unsigned long long end = (unsigned long long) last + 1;
+    unsigned long long p;
+    for (p = a >> PAGE_BITS; p <= (unsigned long long) last >> PAGE_BITS; p++)
+	mark(p << PAGE_BITS);
+    for (; a < end && (a & 7); a++)
+	bitmap_set(a);
+    for (; a + 8 <= end; a += 8)
+	__atomic_store_n(&bytes[a >> 3], 0xff, __ATOMIC_RELAXED);
+    for (; a < end; a++)
+	bitmap_set(a);
+}
+
+/*
+ * Bits set from 'a' up to 'end', all in one page
+ */
+static unsigned long long
+count_bits(unsigned long long a, unsigned long long end)
+{
+    unsigned long long c = 0;
+    if (a & 63) {
+	uint64_t w = word(a >> 6) >> (a & 63);
+	unsigned int k = 64 - (a & 63);
+	if (end - a < k)
+	    return __builtin_popcountll(w & (((uint64_t)1 << (end - a)) - 1));
+	c += __builtin_popcountll(w);
+	a += k;
+    }
+    c += popcount_words(bitmap + (a >> 6), (end - a) >> 6);
+    a += (end - a) & ~63ULL;
+    if (a < end)
+	c += __builtin_popcountll(word(a >> 6) & (((uint64_t)1 << (end - a)) - 1));
+    return c;
+}
+
+/*
+ * Number of addresses seen among the 'n' starting at 'first'
+ */
+unsigned long long
+bitmap_count(unsigned int first, unsigned long long n)
+{
+    unsigned long long a = first;
+    unsigned long long end = a + n;
+    unsigned long long c = 0;
+    if (end > (1ULL << 32))
+	end = 1ULL << 32;
+    while (a < end) {
+	unsigned long long pend = (a | ((1ULL << PAGE_BITS) - 1)) + 1;
+	if (pend > end)
+	    pend = end;
+	if (touched[a >> PAGE_BITS])
+	    c += count_bits(a, pend);
+	a = pend;
+    }
+    return c;
+}
@@ -0,0 +1,19 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdint.h>
+
+/*
+ * One bit for every IPv4 address, for -U.  Address a is bit (a & 7) of
+ * byte (a >> 3), which is the layout of a raw address bitmap file.
+ */
+#define BITMAP_BYTES ((size_t)1 << 29)
+
+void bitmap_init(const char *file);
+void bitmap_free(void);
+void bitmap_set(unsigned int addr);
+void bitmap_set_range(unsigned int first, unsigned int last);
+unsigned long long bitmap_count(unsigned int first, unsigned long long n);
+extern const char *bitmap_popcount_name;
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * The count grid holds one counter for every pixel in the data area of the
+ * image.  Input is accumulated here and only turned into colors when the
+ * image is saved.  Tile output keeps it as a table of pages instead, so
+ * that a grid too large to allocate whole can still be drawn if most of it
+ * is empty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "ipv4-heatmap.h"
+#include "counts.h"
+
+count_t *count_grid = NULL;
+count_t **count_pages = NULL;	/* the paged store, or NULL */
+int count_grid_order = 0;
+int count_page_order = 0;
+unsigned int count_grid_size = 0;	/* width and height */
+
+void
+counts_init(int order, int paged)
+{
+    size_t n;
+    count_grid_order = order;
+    count_grid_size = 1U << order;
+    count_page_order = order < COUNT_PAGE_ORDER ? order : COUNT_PAGE_ORDER;
+    if (paged) {
+	count_pages = counts_alloc_pages();
+	if (debug)
+	    fprintf(stderr, "count grid = %ux%u, %zu pages of %zu cells\n",
+		count_grid_size, count_grid_size, counts_pages(), counts_page_cells());
+	return;
+    }
+    n = (size_t)count_grid_size * count_grid_size;
+    count_grid = calloc(n, sizeof(*count_grid));
+    if (NULL == count_grid)
+	err(1, "count grid (%zu cells)", n);
+    if (debug)
+	fprintf(stderr, "count grid = %ux%u, %zu bytes\n",
+	    count_grid_size, count_grid_size, n * sizeof(*count_grid));
+}
+
+size_t
+counts_cells(void)
+{
+    return (size_t)count_grid_size * count_grid_size;
+}
+
+/*
+ * A private, zeroed grid with the same geometry as count_grid
+ */
+count_t *
+counts_alloc(void)
+{
+    count_t *g = calloc(counts_cells(), sizeof(*g));
+    if (NULL == g)
+	err(1, "count grid (%zu cells)", counts_cells());
+    return g;
+}
+
+uint64_t *
+counts_alloc_set(void)
+{
+    uint64_t *s = calloc(SET_WORDS(counts_cells()), sizeof(*s));
+    if (NULL == s)
+	err(1, "count grid set bitmap");
+    return s;
+}
+
+/*
+ * Fold grid b into grid a for set-bitmap words [w0, w1), as if b's input
+ * came after a's.  Cells that b set replace a's value, and everything
+ * else adds.  Either bitmap may be NULL.
+ */
+static void
+merge_words(count_t *a, uint64_t *as, const count_t *b, const uint64_t *bs,
+    size_t cells, size_t w0, size_t w1)
+{
+    size_t w;
+    for (w = w0; w < w1; w++) {
+	uint64_t m = bs ? bs[w] : 0;
+	count_t *pa = a + (w << 6);
+	const count_t *pb = b + (w << 6);
+	unsigned int n = cells - (w << 6) < 64 ? cells - (w << 6) : 64;
+	unsigned int i;
+	if (0 == m) {
+	    for (i = 0; i < n; i++)
+		COUNT_ADD(pa[i], pb[i]);
+	    continue;
+	}
+	for (i = 0; i < n; i++) {
+	    if ((m >> i) & 1)
+		pa[i] = pb[i];
+	    else
+		COUNT_ADD(pa[i], pb[i]);
+	}
+	if (as)
+	    as[w] |= m;
+    }
+}
+
+struct reduce_job {
+    count_t **grids;
+    uint64_t **sets;
+    int n;
+    int stride;
+    int nthreads;
+    int tid;
+};
+
+#define REDUCE_STRIPES_PER_THREAD 4
+
+/*
+ * One round of the reduction.  Work items are (pair, stripe) and are dealt
+ * out to the threads round-robin, so every thread stays busy even when
+ * only a few pairs remain.
+ */
+static void *
+reduce_round(void *arg)
+{
+    struct reduce_job *j = arg;
+    size_t words = SET_WORDS(counts_cells());
+    int stripes = j->nthreads * REDUCE_STRIPES_PER_THREAD;
+    int pairs = 0;
+    int item;
+    int i;
+    for (i = 0; i + j->stride < j->n; i += 2 * j->stride)
+	pairs++;
+    for (item = j->tid; item < pairs * stripes; item += j->nthreads) {
+	int a = (item / stripes) * 2 * j->stride;
+	int b = a + j->stride;
+	int s = item % stripes;
+	merge_words(j->grids[a], j->sets[a], j->grids[b], j->sets[b],
+	    counts_cells(), words * s / stripes, words * (s + 1) / stripes);
+    }
+    return NULL;
+}
+
+/*
+ * Merge grids[0..n-1], which hold consecutive pieces of the input, into
+ * grids[0] with a pairwise tree reduction.  Each round runs on 'nthreads'
+ * threads.
+ */
+void
+counts_reduce(count_t **grids, uint64_t **sets, int n, int nthreads)
+{
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    struct reduce_job *jobs = calloc(nthreads, sizeof(*jobs));
+    int stride;
+    int t;
+    if (NULL == tids || NULL == jobs)
+	err(1, "calloc");
+    for (stride = 1; stride < n; stride *= 2) {
+	for (t = 0; t < nthreads; t++) {
+	    jobs[t].grids = grids;
+	    jobs[t].sets = sets;
+	    jobs[t].n = n;
+	    jobs[t].stride = stride;
+	    jobs[t].nthreads = nthreads;
+	    jobs[t].tid = t;
+	    if (0 != pthread_create(&tids[t], NULL, reduce_round, &jobs[t]))
+		errx(1, "cannot start merge thread");
+	}
+	for (t = 0; t < nthreads; t++)
+	    pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    free(jobs);
+}
+
+size_t
+counts_pages(void)
+{
+    return (size_t)1 << (2 * (count_grid_order - count_page_order));
+}
+
+size_t
+counts_page_cells(void)
+{
+    return (size_t)1 << (2 * count_page_order);
+}
+
+/*
+ * An empty page table with the geometry of the paged store
+ */
+count_t **
+counts_alloc_pages(void)
+{
+    count_t **t = calloc(counts_pages(), sizeof(*t));
+    if (NULL == t)
+	err(1, "count page table (%zu pages)", counts_pages());
+    return t;
+}
+
+/*
+ * Pages come from one free list shared by all threads.  Pages freed by a
+ * -j worker or a finished zoom level are handed out again, rather than
+ * piling up in the malloc arena of whichever thread freed them.
+ */
+#define PAGE_CHUNK 256		/* pages carved from each allocation */
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static count_t *page_free_list = NULL;	/* linked through the first cell */
+static count_t *chunk = NULL;
+static unsigned int chunk_left = 0;
+static size_t pages_in_use = 0;
+static size_t pages_peak = 0;
+
+count_t *
+counts_page_alloc(void)
+{
+    count_t *p;
+    pthread_mutex_lock(&page_lock);
+    if (page_free_list) {
+	p = page_free_list;
+	memcpy(&page_free_list, p, sizeof(page_free_list));
+    } else {
+	if (0 == chunk_left) {
+	    chunk = malloc(PAGE_CHUNK * counts_page_cells() * sizeof(*chunk));
+	    if (NULL == chunk)
+		err(1, "count pages");
+	    chunk_left = PAGE_CHUNK;
+	}
+	p = chunk;
+	chunk += counts_page_cells();
+	chunk_left--;
+    }
+    if (++pages_in_use > pages_peak)
+	pages_peak = pages_in_use;
+    pthread_mutex_unlock(&page_lock);
+    memset(p, 0, counts_page_cells() * sizeof(*p));
+    return p;
+}
+
+void
+counts_page_free(count_t *p)
+{
+    if (NULL == p)
+	return;
+    pthread_mutex_lock(&page_lock);
+    memcpy(p, &page_free_list, sizeof(page_free_list));
+    page_free_list = p;
+    pages_in_use--;
+    pthread_mutex_unlock(&page_lock);
+}
+
+uint64_t *
+counts_page_alloc_set(void)
+{
+    uint64_t *s = calloc(SET_WORDS(counts_page_cells()), sizeof(*s));
+    if (NULL == s)
+	err(1, "count page set bitmap");
+    return s;
+}
+
+void
+counts_free_pages(count_t **pages)
+{
+    size_t i;
+    if (NULL == pages)
+	return;
+    for (i = 0; i < counts_pages(); i++)
+	counts_page_free(pages[i]);
+    free(pages);
+}
+
+struct reduce_pages_job {
+    count_t ***tables;
+    uint64_t ***sets;
+    int n;
+    int nthreads;
+    int tid;
+};
+
+#define REDUCE_PAGES_PER_ITEM 256
+
+/*
+ * Fold tables[1..n-1] into tables[0], page by page and in order.  A page
+ * that only a later table has is moved over rather than copied.
+ */
+static void *
+reduce_pages(void *arg)
+{
+    struct reduce_pages_job *j = arg;
+    size_t words = SET_WORDS(counts_page_cells());
+    size_t p0;
+    for (p0 = (size_t) j->tid * REDUCE_PAGES_PER_ITEM; p0 < counts_pages();
+	p0 += (size_t) j->nthreads * REDUCE_PAGES_PER_ITEM) {
+	size_t p1 = p0 + REDUCE_PAGES_PER_ITEM < counts_pages() ? p0 + REDUCE_PAGES_PER_ITEM : counts_pages();
+	size_t p;
+	for (p = p0; p < p1; p++) {
+	    count_t **a = &j->tables[0][p];
+	    uint64_t *as = j->sets[0] ? j->sets[0][p] : NULL;
+	    int k;
+	    for (k = 1; k < j->n; k++) {
+		count_t *b = j->tables[k][p];
+		uint64_t *bs = j->sets[k] ? j->sets[k][p] : NULL;
+		if (NULL == b)
+		    continue;
+		if (NULL == *a) {
+		    *a = b;
+		    if (j->sets[0])
+			j->sets[0][p] = as = bs;
+		    else
+			free(bs);
+		} else {
+		    merge_words(*a, as, b, bs, counts_page_cells(), 0, words);
+		    counts_page_free(b);
+		    free(bs);
+		}
+		j->tables[k][p] = NULL;
+		if (j->sets[k])
+		    j->sets[k][p] = NULL;
+	    }
+	}
+    }
+    return NULL;
+}
+
+/*
+ * counts_reduce() for page tables.  'sets' holds a table of per-page set
+ * bitmaps for each page table, or NULL.
+ */
+void
+counts_reduce_pages(count_t ***tables, uint64_t ***sets, int n, int nthreads)
+{
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    struct reduce_pages_job *jobs = calloc(nthreads, sizeof(*jobs));
+    int t;
+    if (NULL == tids || NULL == jobs)
+	err(1, "calloc");
+    for (t = 0; t < nthreads; t++) {
+	jobs[t].tables = tables;
+	jobs[t].sets = sets;
+	jobs[t].n = n;
+	jobs[t].nthreads = nthreads;
+	jobs[t].tid = t;
+	if (0 != pthread_create(&tids[t], NULL, reduce_pages, &jobs[t]))
+	    errx(1, "cannot start merge thread");
+    }
+    for (t = 0; t < nthreads; t++)
+	pthread_join(tids[t], NULL);
+    free(tids);
+    free(jobs);
+}
+
+void
+counts_free(void)
+{
+    free(count_grid);
+    count_grid = NULL;
+    if (count_pages && debug)
+	fprintf(stderr, "count pages: %zu in use, %zu at most (%zu bytes)\n",
+	    pages_in_use, pages_peak, pages_peak * counts_page_cells() * sizeof(count_t));
+    counts_free_pages(count_pages);
+    count_pages = NULL;
+}
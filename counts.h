@@ -0,0 +1,61 @@
+#ifndef COUNTS_H
+#define COUNTS_H
+
+#include <stdint.h>
+
+/*
+ * Per-pixel counters.  Build with -DWIDE_COUNTS=1 for 64-bit counters.
+ */
+#if WIDE_COUNTS
+typedef uint64_t count_t;
+#define COUNT_MAX UINT64_MAX
+#else
+typedef uint32_t count_t;
+#define COUNT_MAX UINT32_MAX
+#endif
+
+#define COUNT_INDEX(x,y) (((size_t)(y) << count_grid_order) + (x))
+#define COUNT_CELL(x,y) count_grid[COUNT_INDEX(x,y)]
+
+/*
+ * The paged store, used for tile output, keeps the grid as square pages
+ * that are only allocated once something is counted in them.  A page is
+ * 1 << (2 * count_page_order) consecutive positions on the curve, so the
+ * pages of a sparse map are few even at one address per cell.
+ */
+#define COUNT_PAGE_ORDER 5
+#define COUNT_PAGE_INDEX(x,y) ((((size_t)(y) >> count_page_order) << \
+	(count_grid_order - count_page_order)) + ((x) >> count_page_order))
+#define COUNT_PAGE_OFFSET(x,y) ((((y) & ((1U << count_page_order) - 1)) << count_page_order) + \
+	((x) & ((1U << count_page_order) - 1)))
+#define COUNT_ADD(c,v) do { count_t _t = (c) + (v); (c) = _t < (c) ? COUNT_MAX : _t; } while (0)
+
+/*
+ * A "set" bitmap marks cells whose value was replaced (exact mode without
+ * -C) rather than added to.  It lets grids filled from consecutive pieces
+ * of the input be merged in order.
+ */
+#define SET_WORDS(cells) (((cells) + 63) / 64)
+#define SET_MARK(set,i) ((set)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+
+void counts_init(int order, int paged);
+void counts_free(void);
+size_t counts_cells(void);
+count_t *counts_alloc(void);
+uint64_t *counts_alloc_set(void);
+void counts_reduce(count_t **grids, uint64_t **sets, int n, int nthreads);
+size_t counts_pages(void);
+size_t counts_page_cells(void);
+count_t **counts_alloc_pages(void);
+count_t *counts_page_alloc(void);
+void counts_page_free(count_t *page);
+uint64_t *counts_page_alloc_set(void);
+void counts_free_pages(count_t **pages);
+void counts_reduce_pages(count_t ***tables, uint64_t ***sets, int n, int nthreads);
+extern count_t *count_grid;
+extern count_t **count_pages;
+extern int count_grid_order;
+extern int count_page_order;
+extern unsigned int count_grid_size;
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Microbenchmark for the curve kernels.  Each kernel is timed over the same
+ * set of curve indexes for orders 1 through 16, and its output is checked
+ * against the original bit-at-a-time routine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <time.h>
+
+#include "hilbert.h"
+#include "xy_from_ip.h"
+
+#define MAX_SAMPLES (1 << 22)
+
+typedef void (*kernel) (unsigned s, int n, unsigned *xp, unsigned *yp);
+
+struct kernel_info {
+    const char *name;
+    kernel ref;
+    kernel fn;
+    int needs_bmi2;
+};
+
+static struct kernel_info kernels[] = {
+    {"hilbert", hil_xy_from_s, hil_xy_from_s, 0},
+    {"hilbert-lut", hil_xy_from_s, hil_xy_from_s_lut, 0},
+    {"morton", mor_xy_from_s, mor_xy_from_s, 0},
+    {"morton-magic", mor_xy_from_s, mor_xy_from_s_magic, 0},
+#if HAVE_BMI2_KERNELS
+    {"morton-bmi2", mor_xy_from_s, mor_xy_from_s_bmi2, 1},
+#endif
+    {NULL, NULL, NULL, 0}
+};
+
+static unsigned int samples[MAX_SAMPLES];
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Small orders are checked exhaustively.  Larger ones get a fixed
+ * pseudo-random sample so that runs are comparable.
+ */
+static unsigned int
+fill_samples(int order)
+{
+    unsigned long long cells = 1ULL << (2 * order);
+    unsigned int n;
+    unsigned int i;
+    unsigned int r = 2463534242U;
+    if (cells <= MAX_SAMPLES) {
+	n = (unsigned int)cells;
+	for (i = 0; i < n; i++)
+	    samples[i] = i;
+	return n;
+    }
+    n = MAX_SAMPLES;
+    for (i = 0; i < n; i++) {
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	samples[i] = (unsigned int)(r & (cells - 1));
+    }
+    return n;
+}
+
+static void
+check(const struct kernel_info *k, int order, unsigned int n)
+{
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+	unsigned x1, y1, x2, y2;
+	k->ref(samples[i], order, &x1, &y1);
+	k->fn(samples[i], order, &x2, &y2);
+	if (x1 != x2 || y1 != y2)
+	    errx(1, "%s: order %d, s=%u gives (%u,%u), expected (%u,%u)",
+		k->name, order, samples[i], x2, y2, x1, y1);
+    }
+}
+
+static double
+timeit(const struct kernel_info *k, int order, unsigned int n)
+{
+    unsigned int i;
+    unsigned int rounds = 1;
+    unsigned int r;
+    unsigned sink = 0;
+    double t0, t1;
+    if (n < MAX_SAMPLES)
+	rounds = MAX_SAMPLES / n;
+    t0 = now();
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < n; i++) {
+	    unsigned x, y;
+	    k->fn(samples[i], order, &x, &y);
+	    sink += x ^ y;
+	}
+    }
+    t1 = now();
+    if (sink == 0x5a5a5a5a)
+	fprintf(stderr, "%u\n", sink);
+    return (t1 - t0) * 1e9 / ((double)n * rounds);
+}
+
+/*
+ * Reference for the batch routines: xy_from_ip() written out with the
+ * original kernels.
+ */
+static unsigned int
+batch_ref(const unsigned *ips, unsigned n, unsigned *xs, unsigned *ys,
+    unsigned char *ok, const struct xy_batch_params *p)
+{
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+	unsigned x, y, s;
+	ok[i] = ips[i] >= p->first && ips[i] <= p->last;
+	if (!ok[i])
+	    continue;
+	s = (ips[i] - p->first) >> p->bits_per_pixel;
+	if (p->morton)
+	    mor_xy_from_s(s, p->order, &x, &y);
+	else
+	    hil_xy_from_s(s, p->order, &x, &y);
+	xs[i] = p->transpose ? y : x;
+	ys[i] = p->transpose ? x : y;
+    }
+    return n;
+}
+
+typedef unsigned int (*batch_fn) (const unsigned *, unsigned, unsigned *,
+    unsigned *, unsigned char *, const struct xy_batch_params *);
+
+static unsigned int bx[2][MAX_SAMPLES];
+static unsigned int by[2][MAX_SAMPLES];
+static unsigned char bok[2][MAX_SAMPLES];
+
+/*
+ * Time a batch routine over the sample addresses and compare its output
+ * with batch_ref().  Returns ns per address.
+ */
+static double
+time_batch(const char *name, batch_fn fn, const struct xy_batch_params *p)
+{
+    unsigned int n = MAX_SAMPLES;
+    unsigned int i;
+    unsigned int done;
+    double t0, t1;
+    batch_ref(samples, n, bx[0], by[0], bok[0], p);
+    t0 = now();
+    done = fn(samples, n, bx[1], by[1], bok[1], p);
+    t1 = now();
+    for (i = 0; i < done; i++) {
+	if (bok[0][i] != bok[1][i] || (bok[0][i] && (bx[0][i] != bx[1][i] || by[0][i] != by[1][i])))
+	    errx(1, "%s: address %u gives (%u,%u,%d), expected (%u,%u,%d)",
+		name, samples[i], bx[1][i], by[1][i], bok[1][i],
+		bx[0][i], by[0][i], bok[0][i]);
+    }
+    return (t1 - t0) * 1e9 / n;
+}
+
+static void
+bench_batch(void)
+{
+    static const struct {
+	const char *crop;
+	unsigned int first;
+	unsigned int last;
+	int bpp;
+	int order;
+    } geometry[] = {
+	{"0.0.0.0/0 -z 8", 0, 0xFFFFFFFF, 8, 12},
+	{"10.0.0.0/8 -z 0", 0x0A000000, 0x0AFFFFFF, 0, 12},
+	{"0.0.0.0/0 -z 0", 0, 0xFFFFFFFF, 0, 16},
+	{NULL, 0, 0, 0, 0}
+    };
+    unsigned int i;
+    unsigned int r = 88172645;
+    int g, morton, transpose;
+    for (i = 0; i < MAX_SAMPLES; i++) {
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	/* keep a share of the samples inside the 10/8 crop */
+	samples[i] = (i & 1) ? (r & 0x00FFFFFF) | 0x0A000000 : r;
+    }
+    printf("\n%-18s %-9s %9s %9s %9s   (ns/address)\n",
+	"batch geometry", "curve", "reference", "avx2", "avx512");
+    for (g = 0; geometry[g].crop; g++) {
+	for (morton = 0; morton < 2; morton++) {
+	    for (transpose = 0; transpose < 2; transpose++) {
+		struct xy_batch_params p;
+		p.first = geometry[g].first;
+		p.last = geometry[g].last;
+		p.bits_per_pixel = geometry[g].bpp;
+		p.order = geometry[g].order;
+		p.morton = morton;
+		p.transpose = transpose;
+		printf("%-18s %-9s %9.2f", geometry[g].crop,
+		    morton ? (transpose ? "morton-T" : "morton") : (transpose ? "hilbert-T" : "hilbert"),
+		    time_batch("reference", batch_ref, &p));
+#if HAVE_SIMD_BATCH
+		if (__builtin_cpu_supports("avx2"))
+		    printf(" %9.2f", time_batch("avx2", xy_batch_avx2, &p));
+		else
+		    printf(" %9s", "-");
+		if (__builtin_cpu_supports("avx512f"))
+		    printf(" %9.2f", time_batch("avx512", xy_batch_avx512, &p));
+		else
+		    printf(" %9s", "-");
+#endif
+		printf("\n");
+	    }
+	}
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int order;
+    struct kernel_info *k;
+    int bmi2 = cpu_has_bmi2();
+    hil_lut_init();
+    printf("%-6s", "order");
+    for (k = kernels; k->name; k++)
+	if (bmi2 || !k->needs_bmi2)
+	    printf(" %14s", k->name);
+    printf("   (ns/op)\n");
+    for (order = 1; order <= 16; order++) {
+	unsigned int n = fill_samples(order);
+	printf("%-6d", order);
+	for (k = kernels; k->name; k++) {
+	    if (k->needs_bmi2 && !bmi2)
+		continue;
+	    check(k, order, n);
+	    printf(" %14.2f", timeit(k, order, n));
+	}
+	printf("\n");
+    }
+    bench_batch();
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Daemon mode (-D).  Input lines arrive on a FIFO, or from any number of
+ * clients of a UNIX stream socket, and are added to the count grid as
+ * they come.  The map is written by a separate thread, every -R seconds
+ * and whenever SIGHUP or a "!render" line asks for it.  That thread only
+ * holds daemon_lock while it copies the counts, so reading input never
+ * waits for a render to finish.
+ *
+ * Lines that start with '!' are commands:
+ *
+ *	!render		write the map now
+ *	!quit		write the map and exit, as SIGTERM does
+ */
+
+#define _GNU_SOURCE		/* ppoll() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ipv4-heatmap.h"
+#include "input.h"
+#include "daemon.h"
+
+#define CLIENT_BUF 65536
+
+pthread_mutex_t daemon_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int requested;
+    int quit;
+    int interval;
+    daemon_render_fn fn;
+} render = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL};
+
+static volatile sig_atomic_t hup_received = 0;
+static volatile sig_atomic_t term_received = 0;
+
+struct client {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+static void
+daemon_signal(int sig)
+{
+    if (SIGHUP == sig)
+	hup_received = 1;
+    else
+	term_received = 1;
+}
+
+static void
+render_request(int quit)
+{
+    pthread_mutex_lock(&render.lock);
+    render.requested = 1;
+    if (quit)
+	render.quit = 1;
+    pthread_cond_signal(&render.cond);
+    pthread_mutex_unlock(&render.lock);
+}
+
+/*
+ * Render when asked, or when the interval is up.  The interval starts
+ * over after each render, however it was asked for.
+ */
+static void *
+render_thread(void *arg)
+{
+    for (;;) {
+	struct timespec next;
+	int quit;
+	clock_gettime(CLOCK_REALTIME, &next);
+	next.tv_sec += render.interval;
+	pthread_mutex_lock(&render.lock);
+	while (!render.requested) {
+	    if (0 == render.interval)
+		pthread_cond_wait(&render.cond, &render.lock);
+	    else if (ETIMEDOUT == pthread_cond_timedwait(&render.cond, &render.lock, &next))
+		break;
+	}
+	render.requested = 0;
+	quit = render.quit;
+	pthread_mutex_unlock(&render.lock);
+	render.fn();
+	if (debug)
+	    fprintf(stderr, "daemon: rendered\n");
+	if (quit)
+	    break;
+    }
+    return NULL;
+}
+
+static void
+command(const char *p, const char *eol)
+{
+    size_t len = eol - p;
+    if (len && '\r' == p[len - 1])
+	len--;
+    if (7 == len && 0 == memcmp(p, "!render", 7))
+	render_request(0);
+    else if (5 == len && 0 == memcmp(p, "!quit", 5))
+	term_received = 1;
+    else
+	warnx("unknown daemon command: %.*s", (int) len, p);
+}
+
+/*
+ * Hand the client's whole lines to 'lines', in runs between commands.
+ * At end of file a last unterminated line counts as whole.  Whatever is
+ * left is kept for the next read.
+ */
+static void
+client_lines(struct client *c, daemon_lines_fn lines, int eof)
+{
+    const char *end = c->buf + c->len;
+    const char *run = c->buf;
+    const char *p = c->buf;
+    if (!eof) {
+	while (end > c->buf && '\n' != end[-1])
+	    end--;
+    }
+    while (p < end) {
+	const char *eol = memchr(p, '\n', end - p);
+	if (NULL == eol)
+	    eol = end;
+	if ('!' == *p) {
+	    if (run < p) {
+		pthread_mutex_lock(&daemon_lock);
+		lines(run, p - run);
+		pthread_mutex_unlock(&daemon_lock);
+	    }
+	    command(p, eol);
+	    run = eol < end ? eol + 1 : end;
+	}
+	p = eol < end ? eol + 1 : end;
+    }
+    if (run < end) {
+	pthread_mutex_lock(&daemon_lock);
+	lines(run, end - run);
+	pthread_mutex_unlock(&daemon_lock);
+    }
+    c->len -= end - c->buf;
+    memmove(c->buf, end, c->len);
+}
+
+/*
+ * Read what the client has sent.  Returns 0 once it has gone away.
+ */
+static int
+client_read(struct client *c, daemon_lines_fn lines)
+{
+    ssize_t n;
+    if (c->len == c->size) {
+	c->size = c->size ? c->size * 2 : CLIENT_BUF;
+	c->buf = realloc(c->buf, c->size);
+	if (NULL == c->buf)
+	    err(1, "realloc");
+    }
+    n = read(c->fd, c->buf + c->len, c->size - c->len);
+    if (n < 0 && (EINTR == errno || EAGAIN == errno))
+	return 1;
+    if (n <= 0) {
+	if (n < 0)
+	    warn("daemon client");
+	client_lines(c, lines, 1);
+	return 0;
+    }
+    c->len += n;
+    client_lines(c, lines, 0);
+    return 1;
+}
+
+/*
+ * A FIFO is opened for writing as well as reading, so that it never sees
+ * end of file when a writer closes it.  Anything else at 'path' is taken
+ * to be a socket left over from an earlier run.
+ */
+static int
+listen_on(const char *path, int *fifo)
+{
+    struct sockaddr_un sun;
+    struct stat sb;
+    int fd;
+    if (0 == stat(path, &sb) && S_ISFIFO(sb.st_mode)) {
+	fd = open(path, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+	    err(1, "%s", path);
+	*fifo = 1;
+	return fd;
+    }
+    *fifo = 0;
+    if (strlen(path) >= sizeof(sun.sun_path))
+	errx(1, "%s: socket path too long", path);
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    if (0 == lstat(path, &sb) && S_ISSOCK(sb.st_mode))
+	unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	err(1, "socket");
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+	err(1, "%s", path);
+    if (listen(fd, 16) < 0)
+	err(1, "%s", path);
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+	err(1, "%s", path);	/* so neither accept() nor a client can stall the loop */
+    return fd;
+}
+
+/*
+ * Serve input on 'path' until SIGTERM, SIGINT or "!quit", then write the
+ * map one last time.  'interval' is the seconds between renders, or 0 to
+ * render only when asked.
+ */
+void
+daemon_run(const char *path, int interval, daemon_lines_fn lines, daemon_render_fn fn)
+{
+    struct client *clients = NULL;
+    struct pollfd *fds = NULL;
+    struct sigaction sa;
+    sigset_t block;
+    sigset_t old;
+    pthread_t tid;
+    int nclients = 0;
+    int fifo;
+    int lfd;
+    int i;
+
+    lfd = listen_on(path, &fifo);
+    render.interval = interval;
+    render.fn = fn;
+
+    /*
+     * Signals go to this thread, and stay blocked except while it waits in
+     * ppoll(), so one cannot arrive between checking the flags and waiting
+     */
+    sigemptyset(&block);
+    sigaddset(&block, SIGHUP);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (0 != pthread_create(&tid, NULL, render_thread, NULL))
+	errx(1, "cannot start render thread");
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (fifo) {
+	clients = calloc(1, sizeof(*clients));
+	if (NULL == clients)
+	    err(1, "calloc");
+	clients[0].fd = lfd;
+	nclients = 1;
+    }
+    if (debug)
+	fprintf(stderr, "daemon: reading %s %s\n", fifo ? "FIFO" : "socket", path);
+
+    while (!term_received) {
+	int nfds = 0;
+	int base = fifo ? 0 : 1;
+	int ready;
+	fds = realloc(fds, (nclients + 1) * sizeof(*fds));
+	if (NULL == fds)
+	    err(1, "realloc");
+	if (!fifo) {
+	    fds[nfds].fd = lfd;
+	    fds[nfds++].events = POLLIN;
+	}
+	for (i = 0; i < nclients; i++) {
+	    fds[nfds].fd = clients[i].fd;
+	    fds[nfds++].events = POLLIN;
+	}
+	ready = ppoll(fds, nfds, NULL, &old);
+	if (ready < 0 && EINTR != errno)
+	    err(1, "ppoll");
+	if (hup_received) {
+	    hup_received = 0;
+	    render_request(0);
+	}
+	if (input_idle) {
+	    pthread_mutex_lock(&daemon_lock);
+	    input_idle();
+	    pthread_mutex_unlock(&daemon_lock);
+	}
+	if (term_received)
+	    break;
+	if (ready <= 0)
+	    continue;		/* a signal; revents are left from before */
+	for (i = nclients - 1; i >= 0; i--) {
+	    if (0 == (fds[base + i].revents & (POLLIN | POLLHUP | POLLERR)))
+		continue;
+	    if (client_read(&clients[i], lines))
+		continue;
+	    close(clients[i].fd);
+	    free(clients[i].buf);
+	    clients[i] = clients[--nclients];
+	}
+	if (!fifo && (fds[0].revents & POLLIN)) {
+	    int fd = accept(lfd, NULL, NULL);
+	    if (fd < 0) {
+		if (EINTR != errno && EAGAIN != errno)
+		    warn("accept");
+		continue;
+	    }
+	    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		warn("fcntl");
+	    clients = realloc(clients, (nclients + 1) * sizeof(*clients));
+	    if (NULL == clients)
+		err(1, "realloc");
+	    memset(&clients[nclients], 0, sizeof(*clients));
+	    clients[nclients++].fd = fd;
+	}
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    render_request(1);
+    pthread_join(tid, NULL);
+    for (i = 0; i < nclients; i++) {
+	if (clients[i].fd != lfd)
+	    close(clients[i].fd);
+	free(clients[i].buf);
+    }
+    free(clients);
+    free(fds);
+    close(lfd);
+    if (!fifo)
+	unlink(path);
+}
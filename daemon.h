@@ -0,0 +1,22 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Add whole lines of input to the map.  Called from the daemon's main
+ * thread with daemon_lock held.
+ */
+typedef void (*daemon_lines_fn) (const char *buf, size_t len);
+
+/*
+ * Write the map.  Called from the render thread, which must hold
+ * daemon_lock only while it copies the counts.
+ */
+typedef void (*daemon_render_fn) (void);
+
+void daemon_run(const char *path, int interval, daemon_lines_fn lines, daemon_render_fn render);
+extern pthread_mutex_t daemon_lock;
+
+#endif
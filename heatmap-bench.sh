@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# IPv4 Heatmap
+# (C) 2007 The Measurement Factory, Inc
+# Licensed under the GPL, version 2
+# http://maps.measurement-factory.com/
+#
+# End to end benchmark.  Each workload-gen workload is mapped by
+# ipv4-heatmap with -X, and the time and peak RSS of each stage are
+# written as tab separated lines, tagged with the git revision, so that
+# the output of two builds can be compared:
+#
+#	heatmap-bench.sh [-j threads] [-n lines] > new.tsv
+#	heatmap-bench.sh -c old.tsv new.tsv
+#
+
+set -e
+
+LINES=1000000
+JOBS=1
+
+usage() {
+	echo "usage: $0 [-j threads] [-n lines]" >&2
+	echo "       $0 -c old.tsv new.tsv" >&2
+	exit 1
+}
+
+#
+# ns/op of each workload and stage in both files, and new/old
+#
+compare() {
+	awk -F '\t' '
+		FNR == 1 { next }
+		NR == FNR { old[$2 "\t" $4] = $7; next }
+		($2 "\t" $4) in old {
+			r = old[$2 "\t" $4] > 0 ? $7 / old[$2 "\t" $4] : 0
+			printf "%-16s %-10s %10.2f %10.2f %6.2f\n", $2, $4, old[$2 "\t" $4], $7, r
+		}' "$1" "$2"
+}
+
+while getopts "c:j:n:" opt; do
+	case $opt in
+	c) OLD=$OPTARG ;;
+	j) JOBS=$OPTARG ;;
+	n) LINES=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $(($OPTIND - 1))
+
+if [ -n "$OLD" ]; then
+	[ $# -eq 1 ] || usage
+	printf "%-16s %-10s %10s %10s %6s\n" workload stage "old ns/op" "new ns/op" ratio
+	compare "$OLD" "$1"
+	exit 0
+fi
+
+DIR=`cd \`dirname $0\` && pwd`
+REV=`git -C $DIR describe --always --dirty 2>/dev/null || echo unknown`
+TMP=`mktemp -d ${TMPDIR:-/tmp}/heatmap-bench.XXXXXX`
+trap 'rm -rf $TMP' 0
+LABELS=$DIR/labels/iana
+
+#
+# name, then workload-gen options, then ipv4-heatmap options
+#
+run() {
+	name=$1
+	gen=$2
+	shift 2
+	echo "$name" >&2
+	$DIR/workload-gen -n $LINES $gen > $TMP/input
+	$DIR/ipv4-heatmap -j $JOBS -X $TMP/stages "$@" $TMP/input
+	awk -v rev="$REV" -v name="$name" -v jobs=$JOBS 'BEGIN { OFS = "\t" }
+		FNR > 1 { print rev, name, jobs, $0 }' $TMP/stages
+}
+
+cd $TMP
+printf "rev\tworkload\tjobs\tstage\tsecs\tops\tns_per_op\tops_per_sec\tmaxrss_kb\n"
+run zipf-random   "-d zipf"          -o map.png
+run zipf-sorted   "-d zipf -s"       -o map.png
+run cluster       "-d cluster"       -o map.png
+run cluster-sorted "-d cluster -s"  -o map.png
+run uniform       "-d uniform"       -o map.png
+run values        "-d zipf -v"       -C -o map.png
+run palette       "-d zipf"          -i -o map.png
+run scaled        "-d zipf"          -l log -o map.png
+run overlays      "-d zipf"          -a $LABELS/iana-labels.txt \
+	-s $LABELS/rfc1918.shades -t Bench -u Count -o map.png
+run tiles         "-d cluster"       -Z tiles
+run timed         "-d zipf -t -r 20000" -g 10 -o map.gif
@@ -1,4 +1,3 @@
-
 /*
  * Figure 14-5 from Hacker's Delight (by Henry S. Warren, Jr. published by
  * Addison Wesley, 2002)
@@ -6,6 +5,8 @@
  * See also http://www.hackersdelight.org/permissions.htm
  */
 
+#include "hilbert.h"
+
 void
 hil_xy_from_s(unsigned s, int order, unsigned *xp, unsigned *yp)
 {
@@ -25,3 +26,60 @@ hil_xy_from_s(unsigned s, int order, unsigned *xp, unsigned *yp)
     *xp = x;			/* Pass back */
     *yp = y;			/* results. */
 }
+
+/*
+ * The same state machine, run four levels (8 bits of s) at a time.  Each
+ * table entry is indexed by (state << 8 | byte) and holds the next state in
+ * bits 8-9, four bits of x in bits 4-7 and four bits of y in bits 0-3.
+ */
+static unsigned short hil_lut[4 << 8];
+
+void
+hil_lut_init(void)
+{
+    unsigned start, b;
+    int i;
+    for (start = 0; start < 4; start++) {
+	for (b = 0; b < 256; b++) {
+	    unsigned state = start, x = 0, y = 0, row;
+	    for (i = 6; i >= 0; i -= 2) {
+		row = 4 * state | ((b >> i) & 3);
+		x = (x << 1) | ((0x936C >> row) & 1);
+		y = (y << 1) | ((0x39C6 >> row) & 1);
+		state = (0x3E6B94C1 >> 2 * row) & 3;
+	    }
+	    hil_lut[start << 8 | b] = state << 8 | x << 4 | y;
+	}
+    }
+}
+
+/*
+ * Table-driven version of hil_xy_from_s().  Levels that don't fill a whole
+ * byte are done first, two bits at a time.  hil_lut_init() must have been
+ * called.
+ */
+void
+hil_xy_from_s_lut(unsigned s, int order, unsigned *xp, unsigned *yp)
+{
+    int i;
+    unsigned state, x, y, row, e;
+    int lut_bits = 2 * (order & ~3);
+
+    state = 0;
+    x = y = 0;
+    for (i = 2 * order - 2; i >= lut_bits; i -= 2) {
+	row = 4 * state | ((s >> i) & 3);
+	x = (x << 1) | ((0x936C >> row) & 1);
+	y = (y << 1) | ((0x39C6 >> row) & 1);
+	state = (0x3E6B94C1 >> 2 * row) & 3;
+    }
+    state <<= 8;
+    for (i = lut_bits - 8; i >= 0; i -= 8) {
+	e = hil_lut[state | ((s >> i) & 0xFF)];
+	x = (x << 4) | ((e >> 4) & 0xF);
+	y = (y << 4) | (e & 0xF);
+	state = e & 0x300;
+    }
+    *xp = x;
+    *yp = y;
+}
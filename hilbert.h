@@ -1,2 +1,10 @@
 extern void hil_xy_from_s(unsigned s, int n, unsigned *xp, unsigned *yp);
+extern void hil_xy_from_s_lut(unsigned s, int n, unsigned *xp, unsigned *yp);
+extern void hil_lut_init(void);
 extern void mor_xy_from_s(unsigned s, int n, unsigned *xp, unsigned *yp);
+extern void mor_xy_from_s_magic(unsigned s, int n, unsigned *xp, unsigned *yp);
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BMI2_KERNELS 1
+extern void mor_xy_from_s_bmi2(unsigned s, int n, unsigned *xp, unsigned *yp);
+#endif
+extern int cpu_has_bmi2(void);
@@ -0,0 +1,242 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Input readers.  Regular files (including a redirected stdin) are mapped
+ * and handed to the parser in one piece.  Pipes and other streams are read
+ * by a separate thread into two large buffers, so that reading the next
+ * buffer overlaps with parsing the current one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ipv4-heatmap.h"
+#include "input.h"
+
+/*
+ * Called about once a second while waiting on a slow stream.
+ */
+void (*input_idle) (void) = NULL;
+
+#ifndef INPUT_BUFSZ
+#define INPUT_BUFSZ (4 << 20)
+#endif
+
+/*
+ * Input lines end with a newline.  Whatever follows the last newline is
+ * an incomplete line.
+ */
+size_t
+input_complete_lines(const char *buf, size_t len)
+{
+    while (len > 0 && '\n' != buf[len - 1])
+	len--;
+    return len;
+}
+
+/*
+ * For input that can only be parsed as a whole (capture files), nothing is
+ * complete until end of input, so a stream is gathered into one buffer.
+ */
+size_t
+input_complete_none(const char *buf, size_t len)
+{
+    return 0;
+}
+
+static void *
+reader_main(void *arg)
+{
+    struct input *in = arg;
+    char *carry = NULL;
+    size_t carry_len = 0;
+    size_t carry_size = 0;
+    int b = 0;
+    for (;;) {
+	size_t len;
+	size_t done;
+	ssize_t n = 1;
+	pthread_mutex_lock(&in->lock);
+	while (in->full[b])
+	    pthread_cond_wait(&in->cond, &in->lock);
+	pthread_mutex_unlock(&in->lock);
+	len = carry_len;
+	for (;;) {
+	    if (len >= in->size[b]) {
+		/* one unit is bigger than the whole buffer */
+		while (len >= in->size[b])
+		    in->size[b] *= 2;
+		in->buf[b] = realloc(in->buf[b], in->size[b]);
+		if (NULL == in->buf[b])
+		    err(1, "%s: input buffer", in->name);
+	    }
+	    if (carry_len) {
+		memcpy(in->buf[b], carry, carry_len);
+		carry_len = 0;
+	    }
+	    n = read(in->fd, in->buf[b] + len, in->size[b] - len);
+	    if (n < 0 && EINTR == errno)
+		continue;
+	    if (n < 0)
+		err(1, "%s", in->name);
+	    len += n;
+	    if (0 == n || len == in->size[b]) {
+		done = n ? in->complete(in->buf[b], len) : len;
+		if (done || 0 == n)
+		    break;
+	    }
+	}
+	carry_len = len - done;
+	if (carry_len > carry_size) {
+	    carry_size = carry_len;
+	    carry = realloc(carry, carry_size);
+	    if (NULL == carry)
+		err(1, "%s: input buffer", in->name);
+	}
+	if (carry_len)
+	    memcpy(carry, in->buf[b] + done, carry_len);
+	pthread_mutex_lock(&in->lock);
+	in->len[b] = done;
+	in->full[b] = 1;
+	if (0 == n)
+	    in->eof = 1;
+	pthread_cond_broadcast(&in->cond);
+	pthread_mutex_unlock(&in->lock);
+	if (0 == n)
+	    break;
+	b ^= 1;
+    }
+    free(carry);
+    return NULL;
+}
+
+/*
+ * Open 'path' ("-" or NULL for stdin).  'complete' tells the stream reader
+ * where the last whole unit in a buffer ends.
+ */
+void
+input_open(struct input *in, const char *path, input_complete_fn complete)
+{
+    struct stat sb;
+    int b;
+    memset(in, 0, sizeof(*in));
+    in->complete = complete;
+    if (NULL == path || 0 == strcmp(path, "-")) {
+	in->name = "stdin";
+	in->fd = 0;
+    } else {
+	in->name = path;
+	in->fd = open(path, O_RDONLY);
+	if (in->fd < 0)
+	    err(1, "%s", path);
+    }
+    if (fstat(in->fd, &sb) < 0)
+	err(1, "%s", in->name);
+    if (S_ISREG(sb.st_mode)) {
+	in->map_len = sb.st_size;
+	if (0 == in->map_len)
+	    return;
+	in->map = mmap(NULL, in->map_len, PROT_READ, MAP_PRIVATE, in->fd, 0);
+	if (MAP_FAILED == in->map)
+	    err(1, "%s: mmap", in->name);
+	if (madvise(in->map, in->map_len, MADV_SEQUENTIAL) < 0 && debug)
+	    warn("%s: madvise", in->name);
+	if (debug)
+	    fprintf(stderr, "%s: mapped %zu bytes\n", in->name, in->map_len);
+	return;
+    }
+    for (b = 0; b < 2; b++) {
+	in->size[b] = INPUT_BUFSZ;
+	in->buf[b] = malloc(in->size[b]);
+	if (NULL == in->buf[b])
+	    err(1, "%s: input buffer", in->name);
+    }
+    in->cur = -1;
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->cond, NULL);
+    if (0 != pthread_create(&in->reader, NULL, reader_main, in))
+	errx(1, "%s: cannot start reader thread", in->name);
+    in->started = 1;
+}
+
+/*
+ * Get the next buffer of whole units.  The buffer stays valid until the
+ * following call.  Returns 0 at end of input.  Buffers come in the same
+ * order the reader thread fills them: 0, 1, 0, 1, ...
+ */
+int
+input_next(struct input *in, const char **buf, size_t *len)
+{
+    int b;
+    if (!in->started) {
+	if (in->map_done || 0 == in->map_len)
+	    return 0;
+	in->map_done = 1;
+	*buf = in->map;
+	*len = in->map_len;
+	return 1;
+    }
+    pthread_mutex_lock(&in->lock);
+    if (in->cur >= 0) {
+	in->full[in->cur] = 0;
+	pthread_cond_broadcast(&in->cond);
+    }
+    b = in->cur < 0 ? 0 : in->cur ^ 1;
+    while (!in->full[b] && !in->eof) {
+	struct timespec ts;
+	if (NULL == input_idle) {
+	    pthread_cond_wait(&in->cond, &in->lock);
+	    continue;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
+	if (ETIMEDOUT == pthread_cond_timedwait(&in->cond, &in->lock, &ts)) {
+	    pthread_mutex_unlock(&in->lock);
+	    input_idle();
+	    pthread_mutex_lock(&in->lock);
+	}
+    }
+    in->cur = b;
+    pthread_mutex_unlock(&in->lock);
+    if (!in->full[b])
+	return 0;
+    *buf = in->buf[b];
+    *len = in->len[b];
+    return 1;
+}
+
+/*
+ * Release an input that has been read to the end.
+ */
+void
+input_close(struct input *in)
+{
+    if (in->map)
+	munmap(in->map, in->map_len);
+    if (in->started) {
+	int b;
+	pthread_join(in->reader, NULL);
+	pthread_mutex_destroy(&in->lock);
+	pthread_cond_destroy(&in->cond);
+	for (b = 0; b < 2; b++)
+	    free(in->buf[b]);
+    }
+    if (in->fd > 0)
+	close(in->fd);
+    memset(in, 0, sizeof(*in));
+}
@@ -0,0 +1,43 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Returns how many bytes at the start of 'buf' make up whole input units
+ * (lines, records).  The rest is carried over to the next buffer.
+ */
+typedef size_t (*input_complete_fn) (const char *buf, size_t len);
+
+struct input {
+    const char *name;
+    int fd;
+    input_complete_fn complete;
+    /* regular files are mapped */
+    char *map;
+    size_t map_len;
+    int map_done;
+    /* anything else is read by a thread into two alternating buffers */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *buf[2];
+    size_t size[2];
+    size_t len[2];
+    int full[2];
+    int eof;
+    int cur;
+    int started;
+};
+
+#define INPUT_MAPPED(in) (NULL != (in)->map)
+
+void input_open(struct input *in, const char *path, input_complete_fn complete);
+int input_next(struct input *in, const char **buf, size_t *len);
+void input_close(struct input *in);
+size_t input_complete_lines(const char *buf, size_t len);
+size_t input_complete_none(const char *buf, size_t len);
+extern void (*input_idle) (void);
+
+#endif
@@ -24,6 +24,7 @@
 #include <err.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -41,15 +42,31 @@
 #include "shade.h"
 #include "legend.h"
 #include "xy_from_ip.h"
+#include "counts.h"
+#include "parse.h"
+#include "input.h"
+#include "pcap.h"
+#include "snapshot.h"
+#include "pngenc.h"
+#include "bbox.h"
+#include "tiles.h"
+#include "text.h"
+#include "bitmap.h"
+#include "daemon.h"
+#include "window.h"
+#include "overlay.h"
+#include "scale.h"
+#include "timing.h"
 
 #define NUM_DATA_COLORS 256
 #undef RELEASE_VER
 
 gdImagePtr image = NULL;
 int colors[NUM_DATA_COLORS];
+int colors_rgb[NUM_DATA_COLORS];	/* colors[] as gdTrueColor() values */
+int background = 0;
 int num_colors = NUM_DATA_COLORS;
 int debug = 0;
-const char *whitespace = " \t\r\n";
 const char *font_file_or_name = "Luxi Mono:style=Regular";
 const char *legend_orient = "vert";
 const char *annotations = NULL;
@@ -60,6 +77,22 @@ int legend_prefixes_flag = 0;
 int reverse_flag = 0;		/* reverse background/font colors */
 int morton_flag = 0;
 int accumulate_counts = 0;	/* for when the input data contains a value */
+int jobs = 1;			/* -j input threads */
+int indexed_flag = 0;		/* -i palette image */
+int binary_value_bytes = -1;	/* -b value width; -1 for text input */
+int capture_addr = 0;		/* -P 's'rc or 'd'st; 0 for text input */
+int capture_bytes = 0;		/* -w weight packets by their size */
+const char *snapshot_load_file = NULL;	/* -L */
+const char *tiles_dir = NULL;	/* -Z */
+int unique_flag = 0;		/* -U count distinct addresses */
+const char *bitmap_file = NULL;	/* -M */
+const char *daemon_path = NULL;	/* -D socket or FIFO */
+int daemon_interval = 0;	/* -R seconds between renders */
+unsigned int window_secs = 0;	/* -W secs[/intervals] */
+int window_intervals = 12;
+double window_halflife = 0.0;	/* -H */
+const char *overlay_cache_dir = NULL;	/* -O */
+const char *timing_file = NULL;	/* -X */
 struct {
 	unsigned int secs;
 	double input_time;
@@ -70,6 +103,9 @@ const char *savename = "map.png";
 
 static void savegif(int done);
 static void annotate(gdImagePtr);
+static void annotate_layers(gdImagePtr);
+static void overlay_layers(gdImagePtr);
+static void write_png(FILE *, gdImagePtr, int);
 
 /*
  * if log_A and log_B are set, then the input data will be scaled
@@ -89,6 +125,8 @@ initialize(void)
     int order = set_order();
     w = 1<<order;
     h = 1<<order;
+    if (tiles_dir && w > TILE_SIZE)
+	w = h = TILE_SIZE;	/* only holds the palette for the tiles */
     if (title && 4096 != w) {
 	warnx("Image width/height must be 4096 to render a legend.");
 	fprintf(stderr,
@@ -108,22 +146,43 @@ initialize(void)
 	fprintf(stderr, "image width = %d\n", w);
 	fprintf(stderr, "image height = %d\n", h);
     }
-    image = gdImageCreateTrueColor(w, h);
-    if (image == NULL)
-	err(1, "gdImageCreateTrueColor(w=%d, h=%d)", w, h);
+    if (indexed_flag) {
+	/* palette images start out as color 0, the first one allocated */
+	image = gdImageCreate(w, h);
+	if (image == NULL)
+	    err(1, "gdImageCreate(w=%d, h=%d)", w, h);
+	background = reverse_flag ?
+	    gdImageColorAllocate(image, 255, 255, 255) :
+	    gdImageColorAllocate(image, 0, 0, 0);
+    } else {
+	image = gdImageCreateTrueColor(w, h);
+	if (image == NULL)
+	    err(1, "gdImageCreateTrueColor(w=%d, h=%d)", w, h);
+    }
     /* first allocated color becomes background by default */
-    if (reverse_flag)
-	gdImageFill(image, 0, 0, gdImageColorAllocate(image, 255, 255, 255));
+    if (reverse_flag && !indexed_flag) {
+	background = gdImageColorAllocate(image, 255, 255, 255);
+	gdImageFill(image, 0, 0, background);
+    }
+    counts_init(order, tiles_dir != NULL);
 
     /*
-     * The default color map ranges from red to blue
+     * The default color map ranges from red to blue.  An indexed image
+     * gets every other color, which leaves half the palette for blending
+     * the annotations over the data.
      */
     for (i = 0; i < NUM_DATA_COLORS; i++) {
 	double hue;
 	double r, g, b;
+	if (indexed_flag && (i & 1)) {
+	    colors[i] = colors[i - 1];
+	    colors_rgb[i] = colors_rgb[i - 1];
+	    continue;
+	}
 	hue = 240.0 * (255 - i) / 255;
 	PIX_HSV_TO_RGB_COMMON(hue, 1.0, 1.0, r, g, b);
 	colors[i] = gdImageColorAllocate(image, r, g, b);
+	colors_rgb[i] = gdTrueColor((int) r, (int) g, (int) b);
 	if (debug > 1)
 	    fprintf(stderr, "colors[%d]=%d\n", i, colors[i]);
     }
@@ -137,115 +196,665 @@ initialize(void)
     log_C = 255.0 / log(log_B / log_A);
 }
 
-static int
-get_pixel_value(unsigned int x, unsigned int y)
-{
-    int color;
-    int k;
-    color = gdImageGetPixel(image, x, y);
-    if (debug)
-	fprintf(stderr, "pixel (%d,%d) has color index %d\n", x, y, color);
-    for (k = 0; k < NUM_DATA_COLORS; k++) {
-	if (colors[k] == color) {
-	    if (debug)
-		fprintf(stderr, "color %d has index %d\n", color, k);
-	    break;
+/*
+ * Pixel color of every count below SCALE_EXACT, with the background for
+ * zero, filled in by render_prepare() for the scale in use.  Larger
+ * counts are rare enough to be scaled one at a time.
+ */
+static int color_lut[SCALE_EXACT];
+static int color_lut_ready = 0;
+
+static inline int
+cell_color(count_t c)
+{
+    return c < SCALE_EXACT ? color_lut[c] : colors[scale_index(c)];
+}
+
+/*
+ * Fit the scale to the counts about to be rendered, the flat 'grid' or the
+ * page table 'pages', and fill the color table for it.  A fixed scale
+ * only needs the table once.
+ */
+static void
+render_prepare(const count_t *grid, count_t **pages)
+{
+    count_t c;
+    double t0 = timing_active ? timing_now() : 0.0;
+    if (color_lut_ready && !scale_auto)
+	return;
+    scale_prepare(grid, pages, jobs);
+    color_lut[0] = background;
+    for (c = 1; c < SCALE_EXACT; c++)
+	color_lut[c] = colors[scale_index(c)];
+    color_lut_ready = 1;
+    if (timing_active)
+	timing_add(TIMING_COLORIZE, timing_now() - t0, 0);
+}
+
+/*
+ * Colorize 'size' x 'size' cells, with rows 'stride' cells apart, into the
+ * top left of the image.  Pixels with a zero count get the background
+ * color.
+ */
+static void
+render_cells(gdImagePtr im, const count_t *cells, size_t stride, unsigned int size)
+{
+    unsigned int x;
+    unsigned int y;
+    double t0 = timing_active ? timing_now() : 0.0;
+    for (y = 0; y < size; y++) {
+	const count_t *row = cells + y * stride;
+	if (!gdImageTrueColor(im)) {
+	    unsigned char *out = im->pixels[y];
+	    for (x = 0; x < size; x++)
+		out[x] = cell_color(row[x]);
+	    continue;
 	}
+	for (x = 0; x < size; x++)
+	    gdImageTrueColorPixel(im, x, y) = cell_color(row[x]);
     }
-    if (k == NUM_DATA_COLORS)	/* not found */
-	k = 0;
-    return k;
+    if (timing_active)
+	timing_add(TIMING_COLORIZE, timing_now() - t0, (uint64_t) size * size);
 }
 
-void
-paint(void)
-{
-    char buf[512];
-    unsigned int line = 1;
-    while (fgets(buf, 512, stdin)) {
-	unsigned int i;
-	unsigned int x;
-	unsigned int y;
-	int color = -1;
-	int k;
-	char *strtok_arg = buf;
-	char *t;
-
-	/*
-	 * In animated gif mode the first field is a timestamp
-	 */
-	if (anim_gif.secs) {
-	    char *e;
-	    t = strtok(strtok_arg, whitespace);
-	    strtok_arg = NULL;
-	    if (NULL == t)
-		continue;
-	    anim_gif.input_time = strtod(t, &e);
-	    if (e == t)
-		errx(1, "bad input parsing time on line %d: %s", line, t);
-	}
+/*
+ * Colorize the count grid into the data area of the image
+ */
+static void
+render(gdImagePtr im)
+{
+    render_prepare(count_grid, NULL);
+    render_cells(im, count_grid, count_grid_size, count_grid_size);
+}
 
-	/*
-	 * next field is an IP address.  We also accept its integer notation
-	 * equivalent.
-	 */
-	t = strtok(strtok_arg, whitespace);
-	strtok_arg = NULL;
-	if (NULL == t)
-	    continue;
-	if (strspn(t, "0123456789") == strlen(t))
-	    i = strtoul(t, NULL, 10);
-	else if (1 == inet_pton(AF_INET, t, &i))
-	    i = ntohl(i);
-	else
-	    errx(1, "bad input parsing IP on line %d: %s", line, t);
-
-	if (0 == xy_from_ip(i, &x, &y))
+/*
+ * Cells painted since the last animated gif frame.  Inclusive bounds;
+ * empty while x0 > x1.
+ */
+#define GIF_DELAY 10		/* hundredths of a second between frames */
+static struct {
+    unsigned int x0, y0, x1, y1;
+} dirty = { ~0U, ~0U, 0, 0 };
+
+/*
+ * Ingest state.  Parsed addresses are mapped to the grid in blocks, so that
+ * the curve calculation can run over many addresses at once.  Each entry
+ * either adds its value to the cell, or (exact mode without -C) replaces
+ * the cell's value.  Each -j worker has its own grid and block.
+ */
+#define PAINT_BLOCK 4096
+struct ingest {
+    count_t *grid;
+    uint64_t *set;		/* cells replaced rather than added, or NULL */
+    count_t **pages;		/* page table instead of 'grid', for -Z */
+    uint64_t **set_pages;	/* page sets instead of 'set', or NULL */
+    const struct input *in;
+    const char *base;		/* start of the input buffer */
+    const char *start;		/* start of this ingest's piece of it */
+    const char *end;
+    unsigned int line;		/* lines read so far in this piece */
+    unsigned int n;
+    unsigned int ip[PAINT_BLOCK];
+    count_t value[PAINT_BLOCK];
+    unsigned char replace[PAINT_BLOCK];
+    unsigned int x[PAINT_BLOCK];
+    unsigned int y[PAINT_BLOCK];
+    unsigned char ok[PAINT_BLOCK];
+    /* -X */
+    unsigned long addrs;
+    double map_secs;
+    double accumulate_secs;
+    double frame_secs;		/* animated gif frames written meanwhile */
+};
+static struct ingest serial;
+
+/*
+ * Add 'value' to the cell at (x, y), or replace it if 'replace' is set
+ */
+static void
+paint_cell(struct ingest *g, unsigned int x, unsigned int y, count_t value, int replace)
+{
+    count_t *grid = g->grid;
+    uint64_t *set = g->set;
+    size_t i;
+    if (g->pages) {
+	size_t p = COUNT_PAGE_INDEX(x, y);
+	if (NULL == g->pages[p])
+	    g->pages[p] = counts_page_alloc();
+	grid = g->pages[p];
+	if (g->set_pages && replace && NULL == g->set_pages[p])
+	    g->set_pages[p] = counts_page_alloc_set();
+	set = g->set_pages ? g->set_pages[p] : NULL;
+	i = COUNT_PAGE_OFFSET(x, y);
+    } else
+	i = COUNT_INDEX(x, y);
+    if (!replace)
+	COUNT_ADD(grid[i], value);
+    else {
+	grid[i] = value;
+	if (set)
+	    SET_MARK(set, i);
+    }
+    if (anim_gif.secs) {
+	if (x < dirty.x0)
+	    dirty.x0 = x;
+	if (x > dirty.x1)
+	    dirty.x1 = x;
+	if (y < dirty.y0)
+	    dirty.y0 = y;
+	if (y > dirty.y1)
+	    dirty.y1 = y;
+    }
+}
+
+static void
+paint_block(struct ingest *g)
+{
+    unsigned int j;
+    double t0 = 0.0;
+    double t1 = 0.0;
+    if (timing_active)
+	t0 = timing_now();
+    xy_from_ip_batch(g->ip, g->n, g->x, g->y, g->ok);
+    if (timing_active)
+	t1 = timing_now();
+    for (j = 0; j < g->n; j++) {
+	if (!g->ok[j])
 	    continue;
 	if (debug)
-	    fprintf(stderr, "%s => %u => (%d,%d)\n", t, i, x, y);
-
-	/*
-	 * next field is an optional value, which might also be
-	 * logarithmically scaled by us.  If no value is given, then find the
-	 * existing value at that point and increment by one.
-	 */
-	t = strtok(NULL, whitespace);
-	if (NULL != t) {
-	    k = atoi(t);
-	    if (accumulate_counts)
-		k += get_pixel_value(x, y);
-	    if (0.0 != log_A) {
-		/*
-		 * apply logarithmic stretching
-		 */
-		k = (int) ((log_C * log((double) k / log_A)) + 0.5);
+	    fprintf(stderr, "%u => (%u,%u)\n", g->ip[j], g->x[j], g->y[j]);
+	paint_cell(g, g->x[j], g->y[j], g->value[j], g->replace[j]);
+    }
+    if (timing_active) {
+	g->map_secs += t1 - t0;
+	g->accumulate_secs += timing_now() - t1;
+	g->addrs += g->n;
+    }
+    g->n = 0;
+    if (g->grid == count_grid && g->pages == count_pages)
+	SNAPSHOT_POLL();
+}
+
+/*
+ * Now that we're doing parsing the entire input line, we can check if an
+ * animated gif file needs to be written out.  Only input inside the
+ * rendered space starts a new frame, and everything parsed so far must be
+ * in the grid before it is saved.  Returns 0 for input outside the space.
+ */
+static int
+paint_frame(struct ingest *g, unsigned int first, unsigned int last)
+{
+    if (last < addr_space_first_addr || first > addr_space_last_addr)
+	return 0;
+    if ((time_t) anim_gif.input_time > anim_gif.next_output) {
+	double t0;
+	paint_block(g);
+	t0 = timing_active ? timing_now() : 0.0;
+	savegif(0);
+	if (timing_active)
+	    g->frame_secs += timing_now() - t0;
+	anim_gif.next_output = (time_t) anim_gif.input_time + anim_gif.secs;
+    }
+    return 1;
+}
+
+/*
+ * Queue one address for the grid.  'value' is added to the address's
+ * cell, or replaces what is there if 'replace' is set.
+ */
+static void
+paint_addr(struct ingest *g, unsigned int addr, count_t value, int replace)
+{
+    if (unique_flag) {
+	bitmap_set(addr);
+	return;
+    }
+    if (anim_gif.secs && !paint_frame(g, addr, addr))
+	return;
+    g->ip[g->n] = addr;
+    g->value[g->n] = value;
+    g->replace[g->n] = replace;
+    if (++g->n == PAINT_BLOCK)
+	paint_block(g);
+}
+
+struct paint_range {
+    struct ingest *g;
+    count_t value;
+    int replace;
+};
+
+static void
+paint_range_block(bbox box, void *arg)
+{
+    struct paint_range *r = arg;
+    int x;
+    int y;
+    for (y = box.ymin; y <= box.ymax; y++)
+	for (x = box.xmin; x <= box.xmax; x++)
+	    paint_cell(r->g, x, y, r->value, r->replace);
+}
+
+/*
+ * Give 'value' to every cell the range of addresses covers, in whole
+ * curve-aligned blocks of cells.  Queued addresses go first, so the
+ * order of replaced values is kept.
+ */
+static void
+paint_range(struct ingest *g, unsigned int first, unsigned int last, count_t value, int replace)
+{
+    struct paint_range r;
+    if (unique_flag) {
+	bitmap_set_range(first, last);
+	return;
+    }
+    if (anim_gif.secs && !paint_frame(g, first, last))
+	return;
+    paint_block(g);
+    r.g = g;
+    r.value = value;
+    r.replace = replace;
+    bbox_blocks(first, last, 0, paint_range_block, &r);
+}
+
+/*
+ * Line numbers in error messages count from the start of the input, which
+ * a -j worker only knows by counting the lines before its piece.  The
+ * daemon has no start of input, so it just warns and skips the line.
+ */
+static void
+bad_input(const struct ingest *g, const char *what, const char *t, int tlen)
+{
+    unsigned int line = g->line;
+    const char *p;
+    for (p = g->base; p < g->start && (p = memchr(p, '\n', g->start - p)); p++)
+	line++;
+    if (daemon_path) {
+	warnx("bad input parsing %s: %.*s", what, tlen, t);
+	return;
+    }
+    if (g->in->fd)
+	errx(1, "%s: bad input parsing %s on line %u: %.*s", g->in->name, what, line, tlen, t);
+    errx(1, "bad input parsing %s on line %u: %.*s", what, line, tlen, t);
+}
+
+/*
+ * Fields are an optional timestamp (animated gif mode only), an IP address
+ * or its integer notation equivalent, and an optional value.  If no value
+ * is given, then the count at that point is incremented by one.  A prefix
+ * or address range in place of the address does the same for every pixel
+ * it covers.
+ */
+static void
+paint_line(struct ingest *g, const char *p, const char *eol)
+{
+    struct input_line r;
+    const char *t;
+    int tlen;
+
+    switch (parse_line(p, eol, anim_gif.secs != 0, &r, &t, &tlen)) {
+    case PARSE_EMPTY:
+	return;
+    case PARSE_BAD_TIME:
+	bad_input(g, "time", t, tlen);
+	return;			/* only the daemon carries on */
+    case PARSE_BAD_IP:
+	bad_input(g, "IP", t, tlen);
+	return;
+    }
+
+    if (anim_gif.secs)
+	anim_gif.input_time = r.time;
+    if (r.last != r.addr)
+	paint_range(g, r.addr, r.last, r.value < 0 ? 1 : r.value,
+	    r.value >= 0 && !accumulate_counts);
+    else if (r.value < 0)
+	paint_addr(g, r.addr, 1, 0);
+    else
+	paint_addr(g, r.addr, r.value, !accumulate_counts);
+}
+
+/*
+ * -X: the time since 't0' that 'g' spent neither mapping, painting nor
+ * writing gif frames went into reading its 'units' lines or records
+ */
+static void
+paint_timing(struct ingest *g, double t0, unsigned long units)
+{
+    if (!timing_active)
+	return;
+    timing_add(TIMING_PARSE, timing_now() - t0 - g->map_secs - g->accumulate_secs - g->frame_secs, units);
+    timing_add(TIMING_MAP, g->map_secs, g->addrs);
+    timing_add(TIMING_ACCUMULATE, g->accumulate_secs, g->addrs);
+    g->map_secs = g->accumulate_secs = g->frame_secs = 0.0;
+    g->addrs = 0;
+}
+
+static void *
+paint_lines(void *arg)
+{
+    struct ingest *g = arg;
+    const char *p = g->start;
+    unsigned int line0 = g->line;
+    double t0 = timing_active ? timing_now() : 0.0;
+    while (p < g->end) {
+	const char *eol = memchr(p, '\n', g->end - p);
+	if (NULL == eol)
+	    eol = g->end;
+	g->line++;
+	paint_line(g, p, eol);
+	p = eol + 1;
+    }
+    paint_block(g);
+    paint_timing(g, t0, g->line - line0);
+    return NULL;
+}
+
+/*
+ * Binary input is a sequence of fixed-size records, each a big-endian
+ * address, optionally preceded by a big-endian 32-bit time_t (in -g mode)
+ * and followed by a big-endian 4 or 8 byte value.
+ */
+static size_t
+binary_record_size(void)
+{
+    return (anim_gif.secs ? 4 : 0) + 4 + binary_value_bytes;
+}
+
+static size_t
+input_complete_records(const char *buf, size_t len)
+{
+    return len - len % binary_record_size();
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void *
+paint_records(void *arg)
+{
+    struct ingest *g = arg;
+    const unsigned char *p = (const unsigned char *) g->start;
+    const unsigned char *end = (const unsigned char *) g->end;
+    size_t rec = binary_record_size();
+    int replace = !accumulate_counts;
+    double t0 = timing_active ? timing_now() : 0.0;
+    for (; (size_t) (end - p) >= rec; p += rec) {
+	const unsigned char *q = p;
+	uint64_t v;
+	if (anim_gif.secs) {
+	    anim_gif.input_time = get32(q);
+	    q += 4;
+	}
+	switch (binary_value_bytes) {
+	case 0:
+	    paint_addr(g, get32(q), 1, 0);
+	    continue;
+	case 4:
+	    v = get32(q + 4);
+	    break;
+	default:
+	    v = (uint64_t) get32(q + 4) << 32 | get32(q + 8);
+	    break;
+	}
+	paint_addr(g, get32(q), v > COUNT_MAX ? COUNT_MAX : (count_t) v, replace);
+    }
+    if (p < end)
+	warnx("%s: ignoring %u trailing bytes", g->in->name, (unsigned) (end - p));
+    paint_block(g);
+    paint_timing(g, t0, (g->end - g->start) / rec);
+    return NULL;
+}
+
+/*
+ * Capture files are walked in place.  Each IPv4 packet adds 1, or its IP
+ * length with -w, to its source or destination address.  Empty input has
+ * no packets, as an empty regular file never gets here at all; a stream
+ * still hands over its one, empty, buffer.
+ */
+static void
+paint_capture(struct ingest *g, const char *buf, size_t len)
+{
+    struct pcap_file f;
+    struct pcap_pkt pkt;
+    unsigned long packets = 0;
+    double t0 = timing_active ? timing_now() : 0.0;
+    if (0 == len)
+	return;
+    pcap_open(&f, g->in->name, buf, len);
+    while (pcap_next(&f, &pkt)) {
+	packets++;
+	if (anim_gif.secs)
+	    anim_gif.input_time = pkt.time;
+	paint_addr(g, 'd' == capture_addr ? pkt.dst : pkt.src,
+	    capture_bytes ? pkt.len : 1, 0);
+    }
+    pcap_close(&f);
+    paint_block(g);
+    paint_timing(g, t0, packets);
+}
+
+/*
+ * Split a mapped file into one newline- or record-aligned piece per
+ * worker.  Each worker fills a private grid, and the grids are then
+ * merged in input order, so the result is the same as reading the file
+ * serially.
+ */
+static void
+paint_parallel(const struct input *in, const char *buf, size_t len)
+{
+    struct ingest **w = calloc(jobs, sizeof(*w));
+    pthread_t *tids = calloc(jobs, sizeof(*tids));
+    count_t **grids = calloc(jobs + 1, sizeof(*grids));
+    uint64_t **sets = calloc(jobs + 1, sizeof(*sets));
+    count_t ***tables = calloc(jobs + 1, sizeof(*tables));
+    uint64_t ***set_tables = calloc(jobs + 1, sizeof(*set_tables));
+    const char *p = buf;
+    size_t rec = binary_value_bytes < 0 ? 0 : binary_record_size();
+    double t0;
+    int j;
+    if (NULL == w || NULL == tids || NULL == grids || NULL == sets ||
+	NULL == tables || NULL == set_tables)
+	err(1, "calloc");
+    grids[0] = count_grid;
+    tables[0] = count_pages;
+    for (j = 0; j < jobs; j++) {
+	const char *e;
+	if (rec) {
+	    e = buf + len / rec * (j + 1) / jobs * rec;
+	    if (j == jobs - 1)
+		e = buf + len;
+	} else {
+	    e = buf + len * (j + 1) / jobs;
+	    if (e < p)
+		e = p;
+	    while (e < buf + len && e > buf && '\n' != e[-1])
+		e++;
+	}
+	w[j] = calloc(1, sizeof(*w[j]));
+	if (NULL == w[j])
+	    err(1, "calloc");
+	if (unique_flag) {
+	    (void)0;		/* all threads share the bitmap */
+	} else if (count_pages) {
+	    w[j]->pages = tables[j + 1] = counts_alloc_pages();
+	    if (!accumulate_counts) {
+		w[j]->set_pages = set_tables[j + 1] = calloc(counts_pages(), sizeof(uint64_t *));
+		if (NULL == set_tables[j + 1])
+		    err(1, "calloc");
 	    }
 	} else {
-	    k = get_pixel_value(x, y);
-	    k++;
+	    w[j]->grid = grids[j + 1] = counts_alloc();
+	    if (!accumulate_counts)
+		w[j]->set = sets[j + 1] = counts_alloc_set();
 	}
-	if (k < 0)
-	    k = 0;
-	if (k >= NUM_DATA_COLORS)
-	    k = NUM_DATA_COLORS - 1;
-	color = colors[k];
-
-	/*
-	 * Now that we're doing parsing the entire input line, we can check if
-	 * an animated gif file needs to be written out.  This is done here because
-         * saving the gif image can call annotation routines that also use strtok().
-	 */
-	if (anim_gif.secs) {
-	    if ((time_t) anim_gif.input_time > anim_gif.next_output) {
-		savegif(0);
-		anim_gif.next_output = (time_t) anim_gif.input_time + anim_gif.secs;
+	w[j]->in = in;
+	w[j]->base = buf;
+	w[j]->start = p;
+	w[j]->end = e;
+	if (0 != pthread_create(&tids[j], NULL, rec ? paint_records : paint_lines, w[j]))
+	    errx(1, "cannot start input thread");
+	p = e;
+    }
+    for (j = 0; j < jobs; j++)
+	pthread_join(tids[j], NULL);
+    t0 = timing_active ? timing_now() : 0.0;
+    if (unique_flag)
+	(void)0;
+    else if (count_pages)
+	counts_reduce_pages(tables, set_tables, jobs + 1, jobs);
+    else
+	counts_reduce(grids, sets, jobs + 1, jobs);
+    if (timing_active)
+	timing_add(TIMING_ACCUMULATE, timing_now() - t0, 0);
+    for (j = 0; j < jobs; j++) {
+	free(grids[j + 1]);
+	free(sets[j + 1]);
+	counts_free_pages(tables[j + 1]);
+	free(set_tables[j + 1]);	/* its pages were moved or freed */
+	free(w[j]);
+    }
+    free(w);
+    free(tids);
+    free(grids);
+    free(sets);
+    free(tables);
+    free(set_tables);
+}
+
+/*
+ * While a stream is quiet, a pending checkpoint is written with whatever
+ * has been read so far.
+ */
+static void
+paint_idle(void)
+{
+    if (!snapshot_requested)
+	return;
+    paint_block(&serial);
+}
+
+/*
+ * Read each input file in turn, or stdin if there are none.  Only mapped
+ * text and binary files are split among -j workers; capture files and
+ * animated gif mode, which depends on the order of the input, are always
+ * serial.
+ */
+void
+paint(int nfiles, char *files[])
+{
+    int f = 0;
+    do {
+	struct input in;
+	const char *buf;
+	size_t len;
+	input_complete_fn complete = input_complete_lines;
+	if (capture_addr)
+	    complete = input_complete_none;
+	else if (binary_value_bytes >= 0)
+	    complete = input_complete_records;
+	input_open(&in, nfiles ? files[f] : NULL, complete);
+	memset(&serial, 0, sizeof(serial));
+	serial.grid = count_grid;
+	serial.pages = count_pages;
+	serial.in = &in;
+	while (input_next(&in, &buf, &len)) {
+	    if (capture_addr) {
+		paint_capture(&serial, buf, len);
+		continue;
 	    }
+	    if (jobs > 1 && INPUT_MAPPED(&in) && !anim_gif.secs) {
+		paint_parallel(&in, buf, len);
+		SNAPSHOT_POLL();
+		continue;
+	    }
+	    serial.base = serial.start = buf;
+	    serial.end = buf + len;
+	    if (binary_value_bytes < 0)
+		paint_lines(&serial);
+	    else
+		paint_records(&serial);
 	}
+	input_close(&in);
+    } while (++f < nfiles);
+}
 
-	gdImageSetPixel(image, x, y, color);
-	line++;
+/*
+ * -U: each pixel's count is the number of addresses seen in its block of
+ * the bitmap.  Pixels with any go through the usual block painting.
+ */
+static void
+paint_bitmap(void)
+{
+    unsigned long long n = 1ULL << addr_space_bits_per_pixel;
+    unsigned long long a;
+    memset(&serial, 0, sizeof(serial));
+    serial.grid = count_grid;
+    serial.pages = count_pages;
+    for (a = addr_space_first_addr; a <= addr_space_last_addr; a += n) {
+	unsigned long long c = bitmap_count(a, n);
+	if (0 == c)
+	    continue;
+	serial.ip[serial.n] = a;
+	serial.value[serial.n] = c > COUNT_MAX ? COUNT_MAX : (count_t) c;
+	serial.replace[serial.n] = 0;
+	if (++serial.n == PAINT_BLOCK)
+	    paint_block(&serial);
     }
+    paint_block(&serial);
+    bitmap_free();
+}
+
+/*
+ * -D: lines from the daemon's clients, with daemon_lock held
+ */
+static void
+daemon_lines(const char *buf, size_t len)
+{
+    if (window_active)
+	serial.pages = window_advance(time(NULL));
+    serial.base = serial.start = buf;
+    serial.end = buf + len;
+    paint_lines(&serial);
+}
+
+static count_t *daemon_grid = NULL;	/* copy of the counts being rendered */
+
+/*
+ * Render a copy of the counts onto a copy of the blank image, and move it
+ * into place, so the output file is always a whole map
+ */
+static void
+daemon_render(void)
+{
+    gdImagePtr im;
+    FILE *fp;
+    char tmp[1024];
+    pthread_mutex_lock(&daemon_lock);
+    if (window_active)
+	window_render(daemon_grid, time(NULL));
+    else
+	memcpy(daemon_grid, count_grid, counts_cells() * sizeof(count_t));
+    pthread_mutex_unlock(&daemon_lock);
+    im = gdImageClone(image);
+    if (NULL == im)
+	errx(1, "gdImageClone() failed");
+    render_prepare(daemon_grid, NULL);
+    render_cells(im, daemon_grid, count_grid_size, count_grid_size);
+    annotate(im);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", savename);
+    fp = fopen(tmp, "wb");
+    if (NULL == fp)
+	err(1, "%s", tmp);
+    write_png(fp, im, jobs);
+    if (0 != fclose(fp))
+	err(1, "%s", tmp);
+    if (rename(tmp, savename) < 0)
+	err(1, "%s", savename);
+    gdImageDestroy(im);
 }
 
 void
@@ -258,6 +867,49 @@ watermark(gdImagePtr i)
 	(u_char *) "IPv4 Heatmap / Measurement Factory", color);
 }
 
+/*
+ * Row source for pngenc_write(), straight from the image's pixels
+ */
+static void
+image_row(void *arg, unsigned int y, unsigned char *out)
+{
+    gdImagePtr im = arg;
+    const int *p;
+    int x;
+    if (!gdImageTrueColor(im)) {
+	memcpy(out, im->pixels[y], gdImageSX(im));
+	return;
+    }
+    p = im->tpixels[y];
+    for (x = 0; x < gdImageSX(im); x++) {
+	*out++ = gdTrueColorGetRed(p[x]);
+	*out++ = gdTrueColorGetGreen(p[x]);
+	*out++ = gdTrueColorGetBlue(p[x]);
+    }
+}
+
+static void
+write_png(FILE *fp, gdImagePtr im, int nthreads)
+{
+    double t0 = timing_active ? timing_now() : 0.0;
+    if (gdImageTrueColor(im)) {
+	pngenc_write(fp, gdImageSX(im), gdImageSY(im), NULL, 0,
+	    image_row, im, nthreads);
+    } else {
+	unsigned char palette[gdMaxColors * 3];
+	int i;
+	for (i = 0; i < gdImageColorsTotal(im); i++) {
+	    palette[i * 3] = gdImageRed(im, i);
+	    palette[i * 3 + 1] = gdImageGreen(im, i);
+	    palette[i * 3 + 2] = gdImageBlue(im, i);
+	}
+	pngenc_write(fp, gdImageSX(im), gdImageSY(im),
+	    palette, gdImageColorsTotal(im), image_row, im, nthreads);
+    }
+    if (timing_active)
+	timing_add(TIMING_ENCODE, timing_now() - t0, (uint64_t) gdImageSX(im) * gdImageSY(im));
+}
+
 void
 save(void)
 {
@@ -265,63 +917,239 @@ save(void)
     if (NULL == pngout)
 	err(1, "%s", savename);
     annotate(image);
-    gdImagePng(image, pngout);
-    fclose(pngout);
+    write_png(pngout, image, jobs);
+    if (0 != fclose(pngout))
+	err(1, "%s", savename);
     gdImageDestroy(image);
     image = NULL;
+    counts_free();
 }
 
+/*
+ * A new image of the same kind as 'im'.  A palette image gets the same
+ * palette, so colors[] and 'background' index it the same way.
+ */
+static gdImagePtr
+image_like(gdImagePtr im, int w, int h)
+{
+    gdImagePtr n;
+    int i;
+    if (gdImageTrueColor(im)) {
+	n = gdImageCreateTrueColor(w, h);
+	if (NULL == n)
+	    errx(1, "gdImageCreateTrueColor() failed");
+	return n;
+    }
+    n = gdImageCreate(w, h);
+    if (NULL == n)
+	errx(1, "gdImageCreate() failed");
+    for (i = 0; i < gdImageColorsTotal(im); i++)
+	gdImageColorAllocate(n, gdImageRed(im, i), gdImageGreen(im, i), gdImageBlue(im, i));
+    return n;
+}
+
+/*
+ * Copy rectangle (x0,y0)-(x1,y1) of a palette image, with the same palette
+ */
+static gdImagePtr
+gif_crop(gdImagePtr im, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1)
+{
+    gdImagePtr sub = image_like(im, x1 - x0 + 1, y1 - y0 + 1);
+    unsigned int y;
+    for (y = y0; y <= y1; y++)
+	memcpy(sub->pixels[y - y0], im->pixels[y] + x0, x1 - x0 + 1);
+    return sub;
+}
+
+/*
+ * Add a frame to the animated gif.  The first frame is the whole map and
+ * its palette becomes the global color table.  After that, only the
+ * rectangle around the cells painted since the previous frame is written;
+ * the annotations do not change between frames, so nothing else can
+ * differ.  Colors that blending adds to a frame's palette are kept in the
+ * master image so that they get the same index in every later frame.
+ */
 void
 savegif(int done)
 {
-	static int ngif = 0;
-	static char *tdir = NULL;
-	static char tmpl[] = "heatmap-tmp-XXXXXX";
-	char fname[512];
-	FILE *gifout = NULL;
-	gdImagePtr clone;
-	if (NULL == tdir) {
-		tdir = mkdtemp(tmpl);
-		if (NULL == tdir)
-			err(1, "%s", tmpl);
-	}
-	snprintf(fname, 512, "%s/%07d.gif", tdir, ngif++);
-	gifout = fopen(fname, "wb");
-	if (NULL == gifout)	
-		err(1, "%s", fname);
-	clone = gdImageClone(image);
-	if (NULL == clone)
+	static FILE *gifout = NULL;
+	static int global_colors = 0;
+	gdImagePtr frame;
+	gdImagePtr sub;
+	double t0;
+	int i;
+	render(image);
+	frame = gdImageClone(image);
+	if (NULL == frame)
 		errx(1, "gdImageClone() failed");
-	annotate(clone);
-	gdImageGif(clone, gifout);
-	fclose(gifout);
-	gdImageDestroy(clone);
+	annotate(frame);
+	for (i = gdImageColorsTotal(image); i < gdImageColorsTotal(frame); i++)
+		gdImageColorAllocate(image, gdImageRed(frame, i),
+		    gdImageGreen(frame, i), gdImageBlue(frame, i));
+	t0 = timing_active ? timing_now() : 0.0;
+	if (NULL == gifout) {
+		gifout = fopen(savename, "wb");
+		if (NULL == gifout)
+			err(1, "%s", savename);
+		gdImageGifAnimBegin(frame, gifout, 1, -1);
+		global_colors = gdImageColorsTotal(frame);
+		gdImageGifAnimAdd(frame, gifout, 0, 0, 0, GIF_DELAY, gdDisposalNone, NULL);
+		dirty.x0 = dirty.y0 = 0;
+		dirty.x1 = gdImageSX(frame) - 1;
+		dirty.y1 = gdImageSY(frame) - 1;
+	} else {
+		if (dirty.x0 > dirty.x1)	/* nothing new; repeat one pixel */
+			dirty.x0 = dirty.x1 = dirty.y0 = dirty.y1 = 0;
+		sub = gif_crop(frame, dirty.x0, dirty.y0, dirty.x1, dirty.y1);
+		gdImageGifAnimAdd(sub, gifout, gdImageColorsTotal(frame) > global_colors,
+		    dirty.x0, dirty.y0, GIF_DELAY, gdDisposalNone, NULL);
+		gdImageDestroy(sub);
+	}
+	if (timing_active)
+		timing_add(TIMING_ENCODE, timing_now() - t0,
+		    (uint64_t) (dirty.x1 - dirty.x0 + 1) * (dirty.y1 - dirty.y0 + 1));
+	if (debug)
+		fprintf(stderr, "gif frame %ux%u at %u,%u\n", dirty.x1 - dirty.x0 + 1,
+		    dirty.y1 - dirty.y0 + 1, dirty.x0, dirty.y0);
+	gdImageDestroy(frame);
+	dirty.x0 = dirty.y0 = ~0U;
+	dirty.x1 = dirty.y1 = 0;
 	/* don't destroy image! */
 	if (done) {
-		char cmd[512];
-		snprintf(cmd, 512, "gifsicle --colors 256 %s/*.gif > %s", tdir, savename);
-		fprintf(stderr, "Executing: %s\n", cmd);
-		if (0 != system(cmd))
-			errx(1, "gifsicle failed");
-		snprintf(cmd, 512, "rm -rf %s", tdir);
-		fprintf(stderr, "Executing: %s\n", cmd);
-		system(cmd);
-		tdir = NULL;
+		gdImageGifAnimEnd(gifout);
+		if (0 != fclose(gifout))
+			err(1, "%s", savename);
+		gifout = NULL;
 		gdImageDestroy(image);
 		image = NULL;
+		counts_free();
 	}
 }
 
+static struct overlay map_overlay;
+static uint64_t map_overlay_scale;	/* fit its legend labels were drawn for */
+
+/*
+ * Everything the map's overlay is drawn from, hashed to name its cache
+ * file: the geometry, options, colors and font, and the contents of the
+ * files it reads
+ */
+static uint64_t
+overlay_key(int sx, int sy)
+{
+    uint64_t h = OVERLAY_HASH_INIT;
+    unsigned int v[] = {OVERLAY_VERSION, sx, sy, addr_space_first_addr, addr_space_last_addr,
+	addr_space_bits_per_pixel, morton_flag, transpose_flag, reverse_flag, annotateColor,
+	legend_prefixes_flag, num_colors};
+    double d[] = {log_A, log_B};
+    uint64_t scale = title && legend_scale_name ? scale_fingerprint() : 0;
+#ifdef GD_VERSION_STRING
+    h = overlay_hash_str(h, GD_VERSION_STRING);
+#endif
+    h = overlay_hash(h, v, sizeof(v));
+    h = overlay_hash(h, d, sizeof(d));
+    h = overlay_hash(h, &scale, sizeof(scale));
+    h = overlay_hash(h, colors_rgb, sizeof(colors_rgb));
+    h = overlay_hash_str(h, title);
+    h = overlay_hash_str(h, legend_orient);
+    h = overlay_hash_str(h, legend_scale_name);
+    h = overlay_hash_file(h, legend_keyfile);
+    h = overlay_hash_file(h, shadings);
+    h = overlay_hash_file(h, annotations);
+    if (annotations || title)
+	h = overlay_hash_file(h, text_font_file());
+    return h;
+}
+
 static void
 annotate(gdImagePtr i)
+{
+    uint64_t key;
+    uint64_t scale = title && legend_scale_name ? scale_fingerprint() : 0;
+    double t0 = timing_active ? timing_now() : 0.0;
+    if (map_overlay.sx == gdImageSX(i) && map_overlay.sy == gdImageSY(i)
+	&& map_overlay_scale == scale) {
+	(void)0;		/* drawn already */
+    } else if (NULL == overlay_cache_dir) {
+	overlay_build(&map_overlay, gdImageSX(i), gdImageSY(i), annotate_layers);
+    } else {
+	key = overlay_key(gdImageSX(i), gdImageSY(i));
+	if (!overlay_load(&map_overlay, overlay_cache_dir, key, gdImageSX(i), gdImageSY(i))) {
+	    overlay_build(&map_overlay, gdImageSX(i), gdImageSY(i), annotate_layers);
+	    overlay_save(&map_overlay, overlay_cache_dir, key);
+	}
+    }
+    map_overlay_scale = scale;	/* an automatic scale moves the labels */
+    overlay_blend(&map_overlay, i);
+    if (timing_active)
+	timing_add(TIMING_OVERLAYS, timing_now() - t0, (uint64_t) gdImageSX(i) * gdImageSY(i));
+}
+
+static void
+annotate_layers(gdImagePtr i)
+{
+    overlay_layers(i);
+    if (title)
+	legend(i, title, legend_orient);
+    watermark(i);
+}
+
+/*
+ * The parts of the annotation that belong to the map itself, and so to
+ * every tile of it
+ */
+static void
+overlay_layers(gdImagePtr i)
 {
     if (shadings)
 	shade_file(i, shadings);
     if (annotations)
 	annotate_file(i, annotations);
-    if (title)
-	legend(i, title, legend_orient);
-    watermark(i);
+}
+
+/*
+ * Write one tile of the -Z pyramid.  The data is drawn in parallel, but
+ * the overlays share font and color state, so they are drawn one tile at
+ * a time.
+ */
+static pthread_mutex_t overlay_lock = PTHREAD_MUTEX_INITIALIZER;
+static int overlays_drawn = 0;
+
+static void
+save_tile(const char *path, const count_t *cells, size_t stride, unsigned int size,
+    int shift, unsigned int x0, unsigned int y0)
+{
+    gdImagePtr tile = image_like(image, size, size);
+    FILE *fp;
+    render_cells(tile, cells, stride, size);
+    if (shadings || annotations) {
+	double t0;
+	pthread_mutex_lock(&overlay_lock);
+	t0 = timing_active ? timing_now() : 0.0;
+	bbox_view.shift = shift;
+	bbox_view.x0 = x0;
+	bbox_view.y0 = y0;
+	bbox_view.quiet = overlays_drawn++ > 0;
+	if (!gdImageTrueColor(tile)) {
+	    struct overlay o;
+	    memset(&o, 0, sizeof(o));
+	    overlay_build(&o, size, size, overlay_layers);
+	    overlay_blend(&o, tile);
+	    overlay_free(&o);
+	} else {
+	    overlay_layers(tile);
+	}
+	if (timing_active)
+	    timing_add(TIMING_OVERLAYS, timing_now() - t0, (uint64_t) size * size);
+	pthread_mutex_unlock(&overlay_lock);
+    }
+    fp = fopen(path, "wb");
+    if (NULL == fp)
+	err(1, "%s", path);
+    write_png(fp, tile, 1);
+    if (0 != fclose(fp))
+	err(1, "%s", path);
+    gdImageDestroy(tile);
 }
 
 void
@@ -337,26 +1165,43 @@ usage(const char *argv0)
     printf("Licensed under the GPL, version 2\n");
     printf("http://maps.measurement-factory.com/\n");
     printf("\n");
-    printf("usage: %s [options] < iplist\n", t ? t + 1 : argv0);
+    printf("usage: %s [options] [file ...] < iplist\n", t ? t + 1 : argv0);
     printf("\t-A float   logarithmic scaling, min value\n");
     printf("\t-B float   logarithmic scaling, max value\n");
     printf("\t-C         values accumulate in Exact input mode\n");
     printf("\t-a file    annotations file\n");
+    printf("\t-b bytes   binary input records with 0, 4 or 8 byte values\n");
     printf("\t-c color   color of annotations (0xRRGGBB)\n");
+    printf("\t-D path    daemon; read lines from a socket or FIFO\n");
     printf("\t-d         increase debugging\n");
-    printf("\t-f font    fontconfig name or .ttf file\n");
+    printf("\t-f font    fontconfig name, .ttf file, or 'builtin'\n");
     printf("\t-g secs    make animated gif from each secs of data\n");
+    printf("\t-H secs    with -D, counts fade with this half-life\n");
     printf("\t-h         draw horizontal legend instead\n");
+    printf("\t-i         indexed (palette) image; faster output\n");
+    printf("\t-j num     threads for reading input and writing the PNG or tiles\n");
     printf("\t-k file    key file for legend\n");
+    printf("\t-L file    load counts from a snapshot file first\n");
+    printf("\t-l scale   fit linear, log, pct or equal scale to the counts\n");
+    printf("\t-M file    with -U, keep the address bitmap in this file\n");
     printf("\t-m         use morton order instead of hilbert\n");
+    printf("\t-O dir     keep drawn overlays in dir for later runs\n");
     printf("\t-o file    output filename\n");
+    printf("\t-P src|dst read pcap/pcapng files, mapping this address\n");
     printf("\t-p         show size of prefixes in legend\n");
+    printf("\t-R secs    with -D, render every secs seconds\n");
     printf("\t-r         reverse; white background, black text\n");
+    printf("\t-S file    save counts to a snapshot file (and on SIGUSR1)\n");
     printf("\t-s file    shading file\n");
     printf("\t-T         transpose; last address in lower left, not upper right\n");
     printf("\t-t str     map title\n");
+    printf("\t-U         count distinct addresses, not input lines\n");
     printf("\t-u str     scale title in legend\n");
+    printf("\t-W secs[/n] with -D, map only the last secs, in n steps (12)\n");
+    printf("\t-w         with -P, weight packets by their IP length\n");
+    printf("\t-X file    write the time each stage took to file\n");
     printf("\t-y cidr    address space to render\n");
+    printf("\t-Z dir     write a z/x/y.png tile pyramid into dir\n");
     printf("\t-z bits    address space bits per pixel\n");
     exit(1);
 }
@@ -365,7 +1210,8 @@ int
 main(int argc, char *argv[])
 {
     int ch;
-    while ((ch = getopt(argc, argv, "A:B:a:Cc:df:g:hk:mo:prs:t:u:y:z:T")) != -1) {
+    char *end;
+    while ((ch = getopt(argc, argv, "A:B:a:b:CD:c:df:g:H:hij:k:L:l:M:mO:o:P:pR:rS:s:t:Uu:W:wX:y:Z:z:T")) != -1) {
 	switch (ch) {
 	case 'A':
 	    log_A = atof(optarg);
@@ -379,9 +1225,53 @@ main(int argc, char *argv[])
 	case 'd':
 	    debug++;
 	    break;
+	case 'D':
+	    daemon_path = strdup(optarg);
+	    break;
+	case 'R':
+	    daemon_interval = strtol(optarg, NULL, 10);
+	    if (daemon_interval < 0)
+		errx(1, "-R interval must not be negative");
+	    break;
 	case 'a':
 	    annotations = strdup(optarg);
 	    break;
+	case 'L':
+	    snapshot_load_file = strdup(optarg);
+	    break;
+	case 'l':
+	    scale_set(optarg);
+	    break;
+	case 'S':
+	    snapshot_file = strdup(optarg);
+	    break;
+	case 'i':
+	    indexed_flag = 1;
+	    break;
+	case 'P':
+	    if (0 == strcmp(optarg, "src") || 0 == strcmp(optarg, "dst"))
+		capture_addr = optarg[0];
+	    else
+		errx(1, "-P must be src or dst");
+	    break;
+	case 'W':
+	    window_secs = strtoul(optarg, &end, 10);
+	    if ('/' == *end)
+		window_intervals = strtol(end + 1, &end, 10);
+	    if (0 == window_secs || window_intervals < 1 || *end)
+		errx(1, "-W needs seconds, and optionally /intervals");
+	    break;
+	case 'w':
+	    capture_bytes = 1;
+	    break;
+	case 'X':
+	    timing_file = strdup(optarg);
+	    break;
+	case 'b':
+	    binary_value_bytes = atoi(optarg);
+	    if (binary_value_bytes != 0 && binary_value_bytes != 4 && binary_value_bytes != 8)
+		errx(1, "-b value width must be 0, 4 or 8");
+	    break;
 	case 'c':
 	    annotateColor = strtol(optarg, NULL, 16);
 	    break;
@@ -394,12 +1284,25 @@ main(int argc, char *argv[])
 	case 'g':
 	    anim_gif.secs = strtol(optarg, NULL, 10);
 	    break;
+	case 'H':
+	    window_halflife = atof(optarg);
+	    if (window_halflife <= 0)
+		errx(1, "-H half-life must be positive");
+	    break;
 	case 'h':
 	    legend_orient = "horiz";
 	    break;
+	case 'j':
+	    jobs = strtol(optarg, NULL, 10);
+	    if (jobs < 1)
+		errx(1, "-j needs at least one thread");
+	    break;
 	case 'k':
 	    legend_keyfile = strdup(optarg);
 	    break;
+	case 'O':
+	    overlay_cache_dir = strdup(optarg);
+	    break;
 	case 'o':
 	    savename = strdup(optarg);
 	    break;
@@ -425,6 +1328,16 @@ main(int argc, char *argv[])
 	case 'y':
 	    set_crop(optarg);
 	    break;
+	case 'U':
+	    unique_flag = 1;
+	    break;
+	case 'M':
+	    bitmap_file = strdup(optarg);
+	    unique_flag = 1;
+	    break;
+	case 'Z':
+	    tiles_dir = strdup(optarg);
+	    break;
 	case 'z':
 	    set_bits_per_pixel(strtol(optarg, NULL, 10));
 	    break;
@@ -435,14 +1348,84 @@ main(int argc, char *argv[])
     }
     argc -= optind;
     argv += optind;
+    if (capture_addr && binary_value_bytes >= 0)
+	errx(1, "-P and -b cannot be used together");
+    if (capture_bytes && !capture_addr)
+	errx(1, "-w requires -P");
+    if (anim_gif.secs)
+	indexed_flag = 1;	/* gif frames share one palette, of half the ramp */
+    if (tiles_dir && anim_gif.secs)
+	errx(1, "-Z and -g cannot be used together");
+    if (unique_flag && anim_gif.secs)
+	errx(1, "-U and -g cannot be used together");
+    if (unique_flag && (snapshot_file || snapshot_load_file))
+	errx(1, "-U keeps addresses, not counts; use -M instead of -L and -S");
+    if (daemon_path && (anim_gif.secs || tiles_dir || unique_flag))
+	errx(1, "-D cannot be used with -g, -Z or -U");
+    if (daemon_path && (capture_addr || binary_value_bytes >= 0))
+	errx(1, "-D reads text lines; it cannot be used with -P or -b");
+    if (daemon_interval && !daemon_path)
+	errx(1, "-R requires -D");
+    if ((window_secs || window_halflife > 0) && !daemon_path)
+	errx(1, "-W and -H require -D");
+    if (window_secs && window_halflife > 0)
+	errx(1, "-W and -H cannot be used together");
+    if ((window_secs || window_halflife > 0) && (snapshot_file || snapshot_load_file || argc))
+	errx(1, "-W and -H map live input only; no snapshots or input files");
+    if (window_secs || window_halflife > 0)
+	accumulate_counts = 1;	/* values add up, so they can be taken away */
+    if (scale_auto && (0.0 != log_A || 0.0 != log_B))
+	errx(1, "-l fits its own scale; it cannot be used with -A or -B");
+    if (scale_auto && anim_gif.secs)
+	errx(1, "-g frames only redraw what changed; -l cannot be used with -g");
+    if (tiles_dir && title)
+	errx(1, "tiles have no legend; -Z and -t cannot be used together");
+    if (timing_file && daemon_path)
+	errx(1, "-X times one run to the end; it cannot be used with -D");
 
+    if (timing_file)
+	timing_init();
+    if (annotations || title)
+	text_font_init();
     initialize();
-    paint();
-    if (anim_gif.secs) {
+    if (unique_flag)
+	bitmap_init(bitmap_file);
+    if (snapshot_load_file)
+	snapshot_load(snapshot_load_file);
+    if (snapshot_file) {
+	signal(SIGUSR1, snapshot_signal);
+	input_idle = paint_idle;
+    }
+    if (argc || !daemon_path)
+	paint(argc, argv);	/* the daemon starts from any files given */
+    if (unique_flag)
+	paint_bitmap();
+    if (snapshot_file && !daemon_path)
+	snapshot_save(snapshot_file);
+    if (daemon_path) {
+	memset(&serial, 0, sizeof(serial));
+	serial.grid = count_grid;
+	daemon_grid = counts_alloc();
+	if (window_secs || window_halflife > 0) {
+	    window_init(window_secs, window_intervals, window_halflife);
+	    serial.grid = NULL;
+	    serial.pages = window_advance(time(NULL));
+	}
+	daemon_run(daemon_path, daemon_interval, daemon_lines, daemon_render);
+	if (snapshot_file)
+	    snapshot_save(snapshot_file);
+    } else if (anim_gif.secs) {
 	savegif(1);
+    } else if (tiles_dir) {
+	render_prepare(NULL, count_pages);
+	tiles_write(tiles_dir, save_tile, jobs);
     } else {
+	render(image);
+	counts_free();		/* make room for the annotation layer */
 	annotate(image);
     	save();
     }
+    if (timing_file)
+	timing_write(timing_file);
     return 0;
 }
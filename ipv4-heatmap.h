@@ -2,8 +2,10 @@ extern const char *font_file_or_name;
 extern const char *legend_keyfile;
 extern const char *legend_scale_name;
 extern double log_A;
+extern double log_B;
 extern double log_C;
 extern int colors[];
+extern int colors_rgb[];
 extern int debug;
 extern int legend_prefixes_flag;
 extern int morton_flag;
@@ -0,0 +1,116 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Compare the legends of two maps of the same input, such as a truecolor
+ * one and a -i one.  The legend is whatever lies beside or below the
+ * square map.  The colors may differ by 'maxdiff' in each channel, which
+ * allows for a palette map using every other step of the color scale.
+ *
+ * Only pixels that are colored in the first map are compared.  The text
+ * and watermark are grey, and how dark their edges come out depends on
+ * how many times the overlay was blended, which differs between a PNG
+ * and a gif frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <gd.h>
+
+static gdImagePtr
+load(const char *file)
+{
+    FILE *fp = fopen(file, "rb");
+    const char *dot = strrchr(file, '.');
+    gdImagePtr im;
+    if (NULL == fp)
+	err(1, "%s", file);
+    if (dot && 0 == strcmp(dot, ".gif"))
+	im = gdImageCreateFromGif(fp);
+    else
+	im = gdImageCreateFromPng(fp);
+    fclose(fp);
+    if (NULL == im)
+	errx(1, "%s: cannot read image", file);
+    return im;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: legend-check [-d maxdiff] map1 map2\n");
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    gdImagePtr a;
+    gdImagePtr b;
+    int maxdiff = 8;
+    int sx;
+    int sy;
+    int x0 = 0;
+    int y0 = 0;
+    int x;
+    int y;
+    unsigned long bad = 0;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "d:")) != -1) {
+	switch (ch) {
+	case 'd':
+	    maxdiff = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    argc -= optind;
+    argv += optind;
+    if (2 != argc)
+	usage();
+    a = load(argv[0]);
+    b = load(argv[1]);
+    sx = gdImageSX(a);
+    sy = gdImageSY(a);
+    if (sx != gdImageSX(b) || sy != gdImageSY(b))
+	errx(1, "%s and %s differ in size", argv[0], argv[1]);
+    if (sx > sy)
+	x0 = sy;
+    else if (sy > sx)
+	y0 = sx;
+    else
+	errx(1, "%s has no legend", argv[0]);
+
+    for (y = y0; y < sy; y++) {
+	for (x = x0; x < sx; x++) {
+	    int p = gdImageGetTrueColorPixel(a, x, y);
+	    int q = gdImageGetTrueColorPixel(b, x, y);
+	    if (gdTrueColorGetRed(p) == gdTrueColorGetGreen(p)
+		&& gdTrueColorGetGreen(p) == gdTrueColorGetBlue(p))
+		continue;
+	    if (abs(gdTrueColorGetRed(p) - gdTrueColorGetRed(q)) > maxdiff
+		|| abs(gdTrueColorGetGreen(p) - gdTrueColorGetGreen(q)) > maxdiff
+		|| abs(gdTrueColorGetBlue(p) - gdTrueColorGetBlue(q)) > maxdiff) {
+		if (0 == bad++)
+		    fprintf(stderr, "first at %d,%d: #%06x and #%06x\n", x, y,
+			p & 0xFFFFFF, q & 0xFFFFFF);
+	    }
+	}
+    }
+    gdImageDestroy(a);
+    gdImageDestroy(b);
+    if (bad)
+	errx(1, "%s and %s: %lu legend pixels differ", argv[0], argv[1], bad);
+    printf("%s and %s: legends match\n", argv[0], argv[1]);
+    return 0;
+}
@@ -22,6 +22,7 @@
 #include "ipv4-heatmap.h"
 #include "annotate.h"
 #include "text.h"
+#include "scale.h"
 
 #define MAX(a,b) (a>b?a:b)
 
@@ -32,6 +33,16 @@ bbox CCC;
 
 static int textColor;
 
+/*
+ * Color 'i' of the data ramp.  The legend is drawn onto a truecolor
+ * overlay even when the map is a palette image, where colors[] holds
+ * palette indices.
+ */
+static int
+ramp_color(gdImagePtr image, int i)
+{
+    return gdImageTrueColor(image) ? colors_rgb[i] : colors[i];
+}
 
 /*
  * Show how big various blocks are
@@ -74,7 +85,7 @@ legend_prefixes(gdImagePtr image)
 	box.ymax += samplebox_ctr_y - hh;
 	gdImageFilledRectangle(image,
 	    box.xmin, box.ymin, box.xmax, box.ymax,
-	    colors[127]);
+	    ramp_color(image, 127));
 	tbox.xmin = samplebox_ctr_x + 128;
 	tbox.xmax = tbox.xmin + 256;
 	tbox.ymin = ((box.ymin + box.ymax) / 2) - 30;
@@ -115,16 +126,12 @@ legend_scale(gdImagePtr image, const char *orient)
 	}
 	gdImageFilledRectangle(image,
 	    tbox.xmin, tbox.ymin, tbox.xmax, tbox.ymax,
-	    colors[i]);
+	    ramp_color(image, i));
     }
 
     for (i = 0; i <= 100; i += pct_inc) {
 	char tmp[10];
-	if (0.0 == log_A) {
-	    snprintf(tmp, 10, "%d%%", i);
-	} else {
-	    snprintf(tmp, 10, "%d", (int)(log_A * exp(2.55 * i / log_C) + 0.5));
-	}
+	scale_label(2.55 * i, tmp, sizeof(tmp));
 	if (0 == strcmp(orient, "vert")) {
 	    BBOX_SET(tbox,
 		BBB.xmin + 256,
@@ -9,6 +9,7 @@ bbox.c
 bbox.h
 hilbert.c
 morton.c
+curve-bench.c
 hsv2rgb.h
 ipv4-heatmap.1
 ipv4-heatmap.c
@@ -17,7 +18,38 @@ shade.c
 text.c
 cidr.h
 cidr.c
+parse.h
+parse.c
+input.h
+input.c
+pcap.h
+pcap.c
+snapshot.h
+snapshot.c
+pngenc.h
+pngenc.c
+tiles.h
+tiles.c
+bitmap.h
+bitmap.c
+daemon.h
+daemon.c
+window.h
+window.c
+overlay.h
+overlay.c
+scale.h
+scale.c
+timing.h
+timing.c
+parse-bench.c
+workload-gen.c
+legend-check.c
+heatmap-bench.sh
+counts.h
+counts.c
 xy_from_ip.c
+xy_from_ip_simd.c
 labels/iana/iana-labels.txt
 labels/iana/ipv4-address-space
 labels/iana/reserved
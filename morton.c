@@ -4,6 +4,12 @@
  * Nominet
  */
 
+#include "hilbert.h"
+
+#if HAVE_BMI2_KERNELS
+#include <immintrin.h>
+#endif
+
 void
 mor_xy_from_s(unsigned s, int order, unsigned *xp, unsigned *yp)
 {
@@ -17,3 +23,50 @@ mor_xy_from_s(unsigned s, int order, unsigned *xp, unsigned *yp)
     *xp = x;
     *yp = y;
 }
+
+/*
+ * Gather the even bits of v into the low half, using the usual
+ * shift-and-mask steps.
+ */
+static unsigned
+compact_bits(unsigned v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+void
+mor_xy_from_s_magic(unsigned s, int order, unsigned *xp, unsigned *yp)
+{
+    if (order < 16)
+	s &= (1U << (2 * order)) - 1;
+    *xp = compact_bits(s);
+    *yp = compact_bits(s >> 1);
+}
+
+#if HAVE_BMI2_KERNELS
+__attribute__((target("bmi2")))
+void
+mor_xy_from_s_bmi2(unsigned s, int order, unsigned *xp, unsigned *yp)
+{
+    if (order < 16)
+	s &= (1U << (2 * order)) - 1;
+    *xp = _pext_u32(s, 0x55555555);
+    *yp = _pext_u32(s, 0xAAAAAAAA);
+}
+#endif
+
+int
+cpu_has_bmi2(void)
+{
+#if HAVE_BMI2_KERNELS
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
+    return 0;
+#endif
+}
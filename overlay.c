@@ -0,0 +1,371 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * The annotations, shading, legend and watermark are the same on every
+ * image of a run: each animated gif frame, each daemon render, and the
+ * map itself.  So they are drawn once, onto a transparent truecolor layer,
+ * and only the runs of pixels they cover are kept.  After that each image
+ * just has those runs blended into it.
+ *
+ * With -O, the runs are also kept on disk, in a file named for a hash of
+ * everything that goes into drawing them, so that later runs with the same
+ * overlays map the file instead of drawing anything.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gd.h>
+
+#include "ipv4-heatmap.h"
+#include "overlay.h"
+
+void
+overlay_free(struct overlay *o)
+{
+    if (o->map) {
+	munmap(o->map, o->map_len);
+    } else {
+	free(o->spans);
+	free(o->pixels);
+    }
+    memset(o, 0, sizeof(*o));
+}
+
+/*
+ * Have 'draw' draw the overlay of an 'sx' by 'sy' image, and keep what it
+ * covers
+ */
+void
+overlay_build(struct overlay *o, int sx, int sy, void (*draw) (gdImagePtr))
+{
+    gdImagePtr layer = gdImageCreateTrueColor(sx, sy);
+    size_t maxspans = 0;
+    size_t npixels = 0;
+    size_t maxpixels = 0;
+    int x;
+    int y;
+    if (NULL == layer)
+	errx(1, "gdImageCreateTrueColor() failed");
+    gdImageAlphaBlending(layer, 0);
+    gdImageFilledRectangle(layer, 0, 0, sx - 1, sy - 1,
+	gdTrueColorAlpha(0, 0, 0, gdAlphaTransparent));
+    gdImageAlphaBlending(layer, 1);
+    draw(layer);
+    overlay_free(o);
+    o->sx = sx;
+    o->sy = sy;
+    for (y = 0; y < sy; y++) {
+	const int *src = layer->tpixels[y];
+	for (x = 0; x < sx; x++) {
+	    struct overlay_span *s;
+	    int x0 = x;
+	    while (x < sx && gdAlphaTransparent != gdTrueColorGetAlpha(src[x]))
+		x++;
+	    if (x == x0)
+		continue;
+	    if (o->nspans == maxspans) {
+		maxspans = maxspans ? maxspans * 2 : 4096;
+		o->spans = realloc(o->spans, maxspans * sizeof(*o->spans));
+		if (NULL == o->spans)
+		    err(1, "realloc");
+	    }
+	    while (npixels + (x - x0) > maxpixels) {
+		maxpixels = maxpixels ? maxpixels * 2 : 65536;
+		o->pixels = realloc(o->pixels, maxpixels * sizeof(*o->pixels));
+		if (NULL == o->pixels)
+		    err(1, "realloc");
+	    }
+	    s = &o->spans[o->nspans++];
+	    s->y = y;
+	    s->x0 = x0;
+	    s->n = x - x0;
+	    s->pixels = npixels;
+	    memcpy(o->pixels + npixels, src + x0, s->n * sizeof(*src));
+	    npixels += s->n;
+	}
+    }
+    gdImageDestroy(layer);
+    if (debug)
+	fprintf(stderr, "overlay: %zu spans, %zu pixels\n", o->nspans, npixels);
+}
+
+/*
+ * gdAlphaBlend() of each pixel of the span over an opaque image, which
+ * the compiler can do several pixels at a time
+ */
+static void
+overlay_blend_span(int *dst, const int *src, int n)
+{
+    int x;
+    for (x = 0; x < n; x++) {
+	int a = gdTrueColorGetAlpha(src[x]);
+	int w = gdAlphaTransparent - a;
+	int r = (gdTrueColorGetRed(src[x]) * w + gdTrueColorGetRed(dst[x]) * a) / gdAlphaMax;
+	int g = (gdTrueColorGetGreen(src[x]) * w + gdTrueColorGetGreen(dst[x]) * a) / gdAlphaMax;
+	int b = (gdTrueColorGetBlue(src[x]) * w + gdTrueColorGetBlue(dst[x]) * a) / gdAlphaMax;
+	dst[x] = (r << 16) | (g << 8) | b;
+    }
+}
+
+/*
+ * Palette images cannot blend translucent colors, so each blended color
+ * is added to the palette while there is room, then mapped to the closest
+ * one.  A cache keeps the palette search off the common path, since runs
+ * of pixels share both colors.  It is kept from one image to the next,
+ * as gif frames and daemon renders start from the same palette; an entry
+ * is only used if the image has the exact blended color at that index.
+ */
+#define BLEND_CACHE 65536
+static void
+overlay_blend_indexed(const struct overlay *o, gdImagePtr im)
+{
+    static struct {
+	int key;
+	int color;
+	int index;
+	int rgb;
+    } cache[BLEND_CACHE];
+    static int cache_ready = 0;
+    size_t i;
+    if (!cache_ready) {
+	memset(cache, 0xff, sizeof(cache));
+	cache_ready = 1;
+    }
+    for (i = 0; i < o->nspans; i++) {
+	const struct overlay_span *s = &o->spans[i];
+	const int *src = o->pixels + s->pixels;
+	unsigned char *dst = im->pixels[s->y] + s->x0;
+	int x;
+	for (x = 0; x < s->n; x++) {
+	    unsigned int h = ((unsigned) src[x] * 31 + dst[x]) % BLEND_CACHE;
+	    int c;
+	    if (cache[h].key == dst[x] && cache[h].color == src[x]
+		&& cache[h].index < gdImageColorsTotal(im)
+		&& cache[h].rgb == gdTrueColorAlpha(gdImageRed(im, cache[h].index),
+		    gdImageGreen(im, cache[h].index), gdImageBlue(im, cache[h].index), 0)) {
+		dst[x] = cache[h].index;
+		continue;
+	    }
+	    c = gdAlphaBlend(gdTrueColorAlpha(gdImageRed(im, dst[x]),
+		    gdImageGreen(im, dst[x]), gdImageBlue(im, dst[x]), 0), src[x]);
+	    cache[h].key = dst[x];
+	    cache[h].color = src[x];
+	    cache[h].index = gdImageColorResolve(im,
+		gdTrueColorGetRed(c), gdTrueColorGetGreen(c), gdTrueColorGetBlue(c));
+	    cache[h].rgb = c & 0xffffff;
+	    dst[x] = cache[h].index;
+	}
+    }
+}
+
+void
+overlay_blend(const struct overlay *o, gdImagePtr im)
+{
+    size_t i;
+    if (!gdImageTrueColor(im)) {
+	overlay_blend_indexed(o, im);
+	return;
+    }
+    for (i = 0; i < o->nspans; i++) {
+	const struct overlay_span *s = &o->spans[i];
+	overlay_blend_span(im->tpixels[s->y] + s->x0, o->pixels + s->pixels, s->n);
+    }
+}
+
+
+/*
+ * 64-bit FNV-1a, for cache keys
+ */
+uint64_t
+overlay_hash(uint64_t h, const void *p, size_t n)
+{
+    const unsigned char *c = p;
+    size_t i;
+    for (i = 0; i < n; i++)
+	h = (h ^ c[i]) * 1099511628211ULL;
+    return h;
+}
+
+/*
+ * A string, with its terminating NUL so that "ab","c" and "a","bc" differ.
+ * NULL hashes differently from any string.
+ */
+uint64_t
+overlay_hash_str(uint64_t h, const char *s)
+{
+    if (NULL == s)
+	return overlay_hash(h, "\377", 1);
+    return overlay_hash(h, s, strlen(s) + 1);
+}
+
+/*
+ * The contents of a file.  One that cannot be read hashes like its name;
+ * drawing will complain about it.
+ */
+uint64_t
+overlay_hash_file(uint64_t h, const char *path)
+{
+    char buf[65536];
+    ssize_t n;
+    int fd;
+    h = overlay_hash_str(h, path);
+    if (NULL == path || (fd = open(path, O_RDONLY)) < 0)
+	return h;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+	h = overlay_hash(h, buf, n);
+    close(fd);
+    return h;
+}
+
+static char *
+cache_path(const char *dir, uint64_t key, const char *suffix)
+{
+    size_t len = strlen(dir) + 40;
+    char *path = malloc(len);
+    if (NULL == path)
+	err(1, "malloc");
+    snprintf(path, len, "%s/%016llx.overlay%s", dir, (unsigned long long) key, suffix);
+    return path;
+}
+
+/*
+ * Whether the spans of a cache file all lie inside an 'sx' by 'sy' image
+ * and take their pixels, in order, from exactly 'npixels' of them, as
+ * overlay_build() lays them out
+ */
+static int
+spans_valid(const struct overlay_span *spans, uint64_t nspans, uint64_t npixels, int sx, int sy)
+{
+    uint64_t pixels = 0;
+    uint64_t i;
+    for (i = 0; i < nspans; i++) {
+	const struct overlay_span *s = &spans[i];
+	if (s->y < 0 || s->y >= sy || s->x0 < 0 || s->n <= 0 || s->n > sx - s->x0
+	    || s->pixels != pixels)
+	    return 0;
+	pixels += s->n;
+    }
+    return pixels == npixels;
+}
+
+/*
+ * Map the cached overlay for 'key'.  Returns 0 if there is none, or it is
+ * not usable, in which case the caller draws it.
+ */
+int
+overlay_load(struct overlay *o, const char *dir, uint64_t key, int sx, int sy)
+{
+    char *path = cache_path(dir, key, "");
+    const struct overlay_header *h;
+    struct stat sb;
+    size_t need;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	free(path);
+	return 0;
+    }
+    if (fstat(fd, &sb) < 0 || (size_t) sb.st_size < sizeof(*h)) {
+	close(fd);
+	free(path);
+	return 0;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+	free(path);
+	return 0;
+    }
+    h = map;
+    need = 0;
+    if (h->nspans <= (uint64_t) sb.st_size / sizeof(struct overlay_span)
+	&& h->npixels <= (uint64_t) sb.st_size / sizeof(int))
+	need = sizeof(*h) + h->nspans * sizeof(struct overlay_span) + h->npixels * sizeof(int);
+    if (memcmp(h->magic, OVERLAY_MAGIC, sizeof(h->magic)) || OVERLAY_VERSION != h->version
+	|| OVERLAY_BYTE_ORDER != h->byte_order || key != h->key
+	|| (uint32_t) sx != h->sx || (uint32_t) sy != h->sy || need != (size_t) sb.st_size
+	|| !spans_valid((const struct overlay_span *) (h + 1), h->nspans, h->npixels, sx, sy)) {
+	warnx("%s: not a usable overlay cache file, drawing again", path);
+	munmap(map, sb.st_size);
+	free(path);
+	return 0;
+    }
+    overlay_free(o);
+    o->sx = sx;
+    o->sy = sy;
+    o->nspans = h->nspans;
+    o->spans = (struct overlay_span *) (h + 1);
+    o->pixels = (int *) (o->spans + o->nspans);
+    o->map = map;
+    o->map_len = sb.st_size;
+    if (debug)
+	fprintf(stderr, "%s: overlay from cache\n", path);
+    free(path);
+    return 1;
+}
+
+/*
+ * Write the overlay to the cache.  It goes to a temporary file that is
+ * renamed into place, so concurrent runs never see half a file.  Failing
+ * to write the cache is not fatal.
+ */
+void
+overlay_save(const struct overlay *o, const char *dir, uint64_t key)
+{
+    struct overlay_header h;
+    char *path = cache_path(dir, key, "");
+    char *tmp;
+    size_t npixels = 0;
+    FILE *fp;
+    size_t len = strlen(path) + 32;
+    int ok;
+    if (o->nspans)
+	npixels = o->spans[o->nspans - 1].pixels + o->spans[o->nspans - 1].n;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, OVERLAY_MAGIC, sizeof(h.magic));
+    h.version = OVERLAY_VERSION;
+    h.byte_order = OVERLAY_BYTE_ORDER;
+    h.key = key;
+    h.sx = o->sx;
+    h.sy = o->sy;
+    h.nspans = o->nspans;
+    h.npixels = npixels;
+    tmp = malloc(len);
+    if (NULL == tmp)
+	err(1, "malloc");
+    snprintf(tmp, len, "%s.%ld.tmp", path, (long) getpid());
+    fp = fopen(tmp, "wb");
+    if (NULL == fp) {
+	warn("%s", tmp);
+	free(tmp);
+	free(path);
+	return;
+    }
+    ok = 1 == fwrite(&h, sizeof(h), 1, fp)
+	&& o->nspans == fwrite(o->spans, sizeof(*o->spans), o->nspans, fp)
+	&& npixels == fwrite(o->pixels, sizeof(*o->pixels), npixels, fp);
+    if (0 != fclose(fp))
+	ok = 0;
+    if (!ok || rename(tmp, path) < 0) {
+	warn("%s", tmp);
+	unlink(tmp);
+    } else if (debug) {
+	fprintf(stderr, "%s: overlay saved\n", path);
+    }
+    free(tmp);
+    free(path);
+}
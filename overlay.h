@@ -0,0 +1,56 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gd.h>
+
+/*
+ * The pixels an overlay covers, as runs along the rows of the image.
+ * Kept in this form in the cache files too, so they are used straight
+ * from the mapped file.
+ */
+struct overlay_span {
+    int32_t y;
+    int32_t x0;
+    int32_t n;
+    uint32_t pixels;		/* index of its first pixel */
+};
+
+struct overlay {
+    int sx;
+    int sy;
+    struct overlay_span *spans;
+    size_t nspans;
+    int *pixels;
+    void *map;			/* cache file the above point into, or NULL */
+    size_t map_len;
+};
+
+#define OVERLAY_MAGIC "IPv4HOvl"
+#define OVERLAY_VERSION 1
+#define OVERLAY_BYTE_ORDER 0x01020304
+
+struct overlay_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;
+    uint32_t sx;
+    uint32_t sy;
+    uint64_t nspans;
+    uint64_t npixels;
+};
+
+void overlay_build(struct overlay *o, int sx, int sy, void (*draw) (gdImagePtr));
+void overlay_blend(const struct overlay *o, gdImagePtr im);
+void overlay_free(struct overlay *o);
+
+#define OVERLAY_HASH_INIT 14695981039346656037ULL
+uint64_t overlay_hash(uint64_t h, const void *p, size_t n);
+uint64_t overlay_hash_str(uint64_t h, const char *s);
+uint64_t overlay_hash_file(uint64_t h, const char *path);
+int overlay_load(struct overlay *o, const char *dir, uint64_t key, int sx, int sy);
+void overlay_save(const struct overlay *o, const char *dir, uint64_t key);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Throughput of parse_line() against the strtok()/inet_pton() code it
+ * replaced, in lines per second.  Both parsers must agree on every line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "parse.h"
+
+#define NLINES (1 << 21)
+
+static const char *whitespace = " \t\r\n";
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The pre-parse_line() code from paint(), returning the same codes.
+ */
+static int
+legacy_parse(char *buf, int with_time, struct input_line *r)
+{
+    char *strtok_arg = buf;
+    char *t;
+    if (with_time) {
+	char *e;
+	t = strtok(strtok_arg, whitespace);
+	strtok_arg = NULL;
+	if (NULL == t)
+	    return PARSE_EMPTY;
+	r->time = strtod(t, &e);
+	if (e == t)
+	    return PARSE_BAD_TIME;
+    }
+    t = strtok(strtok_arg, whitespace);
+    if (NULL == t)
+	return PARSE_EMPTY;
+    if (strspn(t, "0123456789") == strlen(t))
+	r->addr = strtoul(t, NULL, 10);
+    else if (1 == inet_pton(AF_INET, t, &r->addr))
+	r->addr = ntohl(r->addr);
+    else
+	return PARSE_BAD_IP;
+    t = strtok(NULL, whitespace);
+    r->value = -1;
+    if (NULL != t) {
+	r->value = atoi(t);
+	if (r->value < 0)
+	    r->value = 0;
+    }
+    return PARSE_OK;
+}
+
+static void
+compare(const char *line, int with_time)
+{
+    char copy[512];
+    struct input_line a, b;
+    const char *f;
+    int flen;
+    int ra, rb;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    strncpy(copy, line, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    ra = legacy_parse(copy, with_time, &a);
+    rb = parse_line(line, line + strlen(line), with_time, &b, &f, &flen);
+    if (ra != rb || (PARSE_OK == ra &&
+	    (a.addr != b.addr || a.value != b.value ||
+		(with_time && (long)a.time != (long)b.time))))
+	errx(1, "parsers disagree on '%s': %d/%u/%d/%f vs %d/%u/%d/%f",
+	    line, ra, a.addr, a.value, a.time, rb, b.addr, b.value, b.time);
+}
+
+static const char *edge_cases[] = {
+    "", "\n", "  \t\r\n", "1.2.3.4", "1.2.3.4\n", " 1.2.3.4 7 extra\n",
+    "0.0.0.0", "255.255.255.255", "256.1.1.1", "01.2.3.4", "1.2.3", "1.2.3.4.",
+    "1..2.3", ".1.2.3", "1.2.3.4.5", "1.2.3.0 -5", "1.2.3.4 +12", "1.2.3.4 12abc",
+    "1.2.3.4 abc", "1.2.3.4 99999999999999999999", "1.2.3.4 -99999999999999999999",
+    "3232235777", "4294967295", "4294967296", "99999999999999999999999",
+    "0", "1.2.3.4x", "x", "1.2.3.4\t2147483647", "1.2.3.4\v5",
+    "-5", "/24", "-", "/", "1.2.3.4-", "1.2.3.4/", "-1.2.3.4",
+    NULL
+};
+
+static const char *edge_times[] = {
+    "1234567890 1.2.3.4", "1234567890.123 1.2.3.4 5", "1234567890.9999999 1.2.3.4",
+    "1e9 1.2.3.4", "-5 1.2.3.4", "+7.5 1.2.3.4", ".5 1.2.3.4", "5. 1.2.3.4",
+    "abc 1.2.3.4", "12abc 1.2.3.4", "1234567890", "99999999999.5 1.2.3.4",
+    "0x10 1.2.3.4", "9999999999.999999 1.2.3.4",
+    NULL
+};
+
+int
+main(int argc, char *argv[])
+{
+    static char *lines[NLINES];
+    static char *legacy_copy[NLINES];
+    char buf[128];
+    unsigned int r = 2463534242U;
+    int with_time;
+    int i;
+    double t0, t1;
+    struct input_line res;
+    const char *f;
+    int flen;
+    unsigned long sink = 0;
+
+    for (i = 0; edge_cases[i]; i++)
+	compare(edge_cases[i], 0);
+    for (i = 0; edge_times[i]; i++)
+	compare(edge_times[i], 1);
+
+    printf("%-24s %14s %14s\n", "workload", "legacy", "parse_line");
+    for (with_time = 0; with_time < 2; with_time++) {
+	for (i = 0; i < NLINES; i++) {
+	    int n = 0;
+	    r ^= r << 13;
+	    r ^= r >> 17;
+	    r ^= r << 5;
+	    if (with_time)
+		n = snprintf(buf, sizeof(buf), "%u.%03u\t", 1234567890 + i / 1000, i % 1000);
+	    if (i & 1)
+		snprintf(buf + n, sizeof(buf) - n, "%u.%u.%u.%u %u\n",
+		    r >> 24, (r >> 16) & 0xFF, (r >> 8) & 0xFF, r & 0xFF, r % 1000);
+	    else
+		snprintf(buf + n, sizeof(buf) - n, "%u.%u.%u.%u\n",
+		    r >> 24, (r >> 16) & 0xFF, (r >> 8) & 0xFF, r & 0xFF);
+	    lines[i] = strdup(buf);
+	    legacy_copy[i] = strdup(buf);
+	    if (NULL == lines[i] || NULL == legacy_copy[i])
+		err(1, "strdup");
+	    compare(lines[i], with_time);
+	}
+	t0 = now();
+	for (i = 0; i < NLINES; i++) {
+	    legacy_parse(legacy_copy[i], with_time, &res);
+	    sink += res.addr;
+	}
+	t1 = now();
+	printf("%-24s %12.0f/s", with_time ? "time+addr[+value]" : "addr[+value]",
+	    NLINES / (t1 - t0));
+	t0 = now();
+	for (i = 0; i < NLINES; i++) {
+	    parse_line(lines[i], lines[i] + strlen(lines[i]), with_time, &res, &f, &flen);
+	    sink += res.addr;
+	}
+	t1 = now();
+	printf(" %12.0f/s\n", NLINES / (t1 - t0));
+	for (i = 0; i < NLINES; i++) {
+	    free(lines[i]);
+	    free(legacy_copy[i]);
+	}
+    }
+    if (sink == 42)
+	printf("\n");
+    return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Input line parser.  Each field is scanned once, in place, with no
+ * copying and no hidden state.  The accepted syntax is the same as the old
+ * strtok(), strtoul(), inet_pton(), atoi() and strtod() code in paint().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "parse.h"
+
+#define IS_WS(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/*
+ * A NUL ends the line, as it did when lines were NUL-terminated strings.
+ */
+static const char *
+skip_ws(const char *p, const char *end)
+{
+    while (p < end && IS_WS(*p))
+	p++;
+    if (p < end && '\0' == *p)
+	return end;
+    return p;
+}
+
+static const char *
+skip_field(const char *p, const char *end)
+{
+    while (p < end && *p && !IS_WS(*p))
+	p++;
+    return p;
+}
+
+/*
+ * An address is either a dotted quad, following inet_pton() rules (four
+ * octets, no leading zeros), or an all-digit integer with strtoul()
+ * overflow behavior.
+ */
+static int
+parse_addr(const char *p, const char *e, unsigned int *addr)
+{
+    const char *q;
+    unsigned int a = 0;
+    unsigned int octet = 0;
+    int digits = 0;
+    int dots = 0;
+    int bad = 0;
+    for (q = p; q < e; q++) {
+	if (IS_DIGIT(*q)) {
+	    if (digits && 0 == octet)
+		bad = 1;
+	    octet = octet * 10 + (*q - '0');
+	    if (octet > 255)
+		bad = 1;
+	    digits++;
+	} else if ('.' == *q && digits && dots < 3 && !bad) {
+	    a = (a << 8) | octet;
+	    octet = 0;
+	    digits = 0;
+	    dots++;
+	} else {
+	    return 0;
+	}
+    }
+    if (0 == dots) {
+	unsigned long n = 0;
+	for (q = p; q < e; q++) {
+	    unsigned int d = *q - '0';
+	    if (n > (ULONG_MAX - d) / 10) {
+		n = ULONG_MAX;
+		break;
+	    }
+	    n = n * 10 + d;
+	}
+	*addr = (unsigned int)n;
+	return 1;
+    }
+    if (bad || 3 != dots || 0 == digits)
+	return 0;
+    *addr = (a << 8) | octet;
+    return 1;
+}
+
+/*
+ * The address field can also be a range, as a prefix "a.b.c.d/len" or as
+ * "first-last".  A prefix is taken from its network address, whatever the
+ * host bits say.
+ */
+static int
+parse_range(const char *p, const char *e, unsigned int *first, unsigned int *last)
+{
+    const char *q;
+    if (parse_addr(p, e, first)) {
+	*last = *first;
+	return 1;
+    }
+    for (q = p; q < e && '/' != *q && '-' != *q; q++)
+	;
+    if (q == e || q == p || !parse_addr(p, q, first))
+	return 0;
+    if ('-' == *q)
+	return q + 1 < e && parse_addr(q + 1, e, last) && *last >= *first;
+    {
+	unsigned int len = 0;
+	unsigned int host;
+	const char *d;
+	if (q + 1 == e || e - q > 3)
+	    return 0;
+	for (d = q + 1; d < e; d++) {
+	    if (!IS_DIGIT(*d))
+		return 0;
+	    len = len * 10 + (*d - '0');
+	}
+	if (len > 32)
+	    return 0;
+	host = len < 32 ? ~0U >> len : 0;
+	*first &= ~host;
+	*last = *first | host;
+    }
+    return 1;
+}
+
+/*
+ * Same result as atoi(): optional sign, then leading digits, saturating
+ * like strtol() before the conversion to int.
+ */
+static int
+parse_value(const char *p, const char *e)
+{
+    unsigned long n = 0;
+    int neg = 0;
+    if (p < e && ('-' == *p || '+' == *p))
+	neg = ('-' == *p++);
+    for (; p < e && IS_DIGIT(*p); p++) {
+	unsigned int d = *p - '0';
+	if (n > ((unsigned long)LONG_MAX + neg - d) / 10) {
+	    n = (unsigned long)LONG_MAX + neg;
+	    break;
+	}
+	n = n * 10 + d;
+    }
+    return neg ? (int)(long)(0UL - n) : (int)(long)n;
+}
+
+/*
+ * Timestamps of the usual "seconds[.fraction]" form are converted
+ * directly.  The limits on digit counts keep the result within rounding
+ * distance of strtod(), which handles everything else.
+ */
+static int
+parse_time(const char *p, const char *e, double *t)
+{
+    const char *q = p;
+    unsigned long long whole = 0;
+    unsigned long frac = 0;
+    unsigned long scale = 1;
+    char buf[512];
+    char *end;
+    size_t len;
+    while (q < e && IS_DIGIT(*q) && q - p < 10)
+	whole = whole * 10 + (*q++ - '0');
+    if (q > p && q < e && '.' == *q) {
+	const char *f = ++q;
+	while (q < e && IS_DIGIT(*q) && q - f < 6) {
+	    frac = frac * 10 + (*q++ - '0');
+	    scale *= 10;
+	}
+    }
+    if (q > p && q == e) {
+	*t = (double)whole + (double)frac / scale;
+	return 1;
+    }
+    len = e - p;
+    if (len >= sizeof(buf))
+	len = sizeof(buf) - 1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    *t = strtod(buf, &end);
+    return end != buf;
+}
+
+/*
+ * Parse one line from 'p' up to 'end'.  The optional timestamp comes
+ * first, then the address or range, then the optional value; fields are
+ * separated by whitespace and anything after the value is ignored.  On
+ * error, 'field' and 'field_len' point at the bad field.
+ */
+int
+parse_line(const char *p, const char *end, int with_time,
+    struct input_line *r, const char **field, int *field_len)
+{
+    const char *e;
+    p = skip_ws(p, end);
+    if (p == end)
+	return PARSE_EMPTY;
+    e = skip_field(p, end);
+    if (with_time) {
+	if (!parse_time(p, e, &r->time)) {
+	    *field = p;
+	    *field_len = e - p;
+	    return PARSE_BAD_TIME;
+	}
+	p = skip_ws(e, end);
+	if (p == end)
+	    return PARSE_EMPTY;
+	e = skip_field(p, end);
+    }
+    if (!parse_range(p, e, &r->addr, &r->last)) {
+	*field = p;
+	*field_len = e - p;
+	return PARSE_BAD_IP;
+    }
+    p = skip_ws(e, end);
+    if (p == end) {
+	r->value = -1;
+	return PARSE_OK;
+    }
+    e = skip_field(p, end);
+    r->value = parse_value(p, e);
+    if (r->value < 0)
+	r->value = 0;
+    return PARSE_OK;
+}
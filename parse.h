@@ -0,0 +1,24 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+/*
+ * One parsed line of input.  'value' is -1 when the line has no value
+ * field.  A line for a range of addresses has its first address in 'addr'
+ * and its last in 'last'; otherwise the two are the same.
+ */
+struct input_line {
+    double time;
+    unsigned int addr;
+    unsigned int last;
+    int value;
+};
+
+#define PARSE_OK 1
+#define PARSE_EMPTY 0
+#define PARSE_BAD_TIME -1
+#define PARSE_BAD_IP -2
+
+int parse_line(const char *p, const char *end, int with_time,
+    struct input_line *r, const char **field, int *field_len);
+
+#endif
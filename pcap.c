@@ -0,0 +1,330 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Capture file reader.  Walks the record headers of a pcap or pcapng file
+ * that is already in memory (normally mapped) and returns the IPv4 header
+ * fields of each packet.  Non-IPv4 packets and unknown blocks are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#include "pcap.h"
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 1
+#define PCAPNG_OPB 2		/* obsolete Packet Block */
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+
+#define OPT_IF_TSRESOL 9
+#define OPT_IF_TSOFFSET 14
+
+/* link-layer header types */
+#define DLT_NULL 0
+#define DLT_EN10MB 1
+#define DLT_RAW_OLD 12
+#define DLT_RAW_OPENBSD 14
+#define DLT_RAW 101
+#define DLT_LOOP 108
+#define DLT_LINUX_SLL 113
+#define DLT_IPV4 228
+#define DLT_LINUX_SLL2 276
+
+static inline unsigned int
+swap32(unsigned int v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static inline unsigned int
+rd32(const struct pcap_file *f, const unsigned char *p)
+{
+    unsigned int v;
+    memcpy(&v, p, 4);
+    return f->swapped ? swap32(v) : v;
+}
+
+static inline unsigned int
+rd16(const struct pcap_file *f, const unsigned char *p)
+{
+    unsigned short v;
+    memcpy(&v, p, 2);
+    return f->swapped ? (unsigned short) (v >> 8 | v << 8) : v;
+}
+
+static inline unsigned int
+be16(const unsigned char *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+static inline unsigned int
+be32(const unsigned char *p)
+{
+    return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static struct pcap_if *
+add_if(struct pcap_file *f, unsigned int linktype)
+{
+    struct pcap_if *i;
+    if (f->nifs == f->ifs_size) {
+	f->ifs_size = f->ifs_size ? f->ifs_size * 2 : 4;
+	f->ifs = realloc(f->ifs, f->ifs_size * sizeof(*f->ifs));
+	if (NULL == f->ifs)
+	    err(1, "%s: realloc", f->name);
+    }
+    i = &f->ifs[f->nifs++];
+    i->linktype = linktype;
+    i->tsunit = 1e-6;
+    i->tsoffset = 0.0;
+    return i;
+}
+
+void
+pcap_open(struct pcap_file *f, const char *name, const char *buf, size_t len)
+{
+    unsigned int magic;
+    memset(f, 0, sizeof(*f));
+    f->name = name;
+    f->p = (const unsigned char *) buf;
+    f->end = f->p + len;
+    if (len < 24)
+	errx(1, "%s: not a capture file", name);
+    memcpy(&magic, buf, 4);
+    if (PCAPNG_SHB == magic) {
+	f->ng = 1;
+	return;
+    }
+    if (PCAP_MAGIC_USEC != magic && PCAP_MAGIC_NSEC != magic) {
+	f->swapped = 1;
+	magic = swap32(magic);
+    }
+    if (PCAP_MAGIC_USEC != magic && PCAP_MAGIC_NSEC != magic)
+	errx(1, "%s: not a capture file", name);
+    add_if(f, rd32(f, f->p + 20) & 0xffff)->tsunit =
+	PCAP_MAGIC_NSEC == magic ? 1e-9 : 1e-6;
+    f->p += 24;
+}
+
+void
+pcap_close(struct pcap_file *f)
+{
+    free(f->ifs);
+    f->ifs = NULL;
+}
+
+/*
+ * Find the IPv4 header in a packet.  Returns NULL if the packet is not
+ * IPv4 or is too short to hold the addresses.
+ */
+static const unsigned char *
+ip_header(unsigned int linktype, const unsigned char *p, unsigned int caplen)
+{
+    unsigned int off;
+    unsigned int type;
+    switch (linktype) {
+    case DLT_EN10MB:
+	off = 12;
+	if (caplen < off + 2)
+	    return NULL;
+	type = be16(p + off);
+	/* 802.1Q and 802.1ad tags */
+	while (0x8100 == type || 0x88a8 == type || 0x9100 == type) {
+	    off += 4;
+	    if (caplen < off + 2)
+		return NULL;
+	    type = be16(p + off);
+	}
+	if (0x0800 != type)
+	    return NULL;
+	off += 2;
+	break;
+    case DLT_RAW:
+    case DLT_RAW_OLD:
+    case DLT_RAW_OPENBSD:
+    case DLT_IPV4:
+	off = 0;
+	break;
+    case DLT_NULL:
+    case DLT_LOOP:
+	/* address family, in either byte order; AF_INET is 2 everywhere */
+	if (caplen < 4)
+	    return NULL;
+	if (2 != be32(p) && 0x02000000 != be32(p))
+	    return NULL;
+	off = 4;
+	break;
+    case DLT_LINUX_SLL:
+	if (caplen < 16 || 0x0800 != be16(p + 14))
+	    return NULL;
+	off = 16;
+	break;
+    case DLT_LINUX_SLL2:
+	if (caplen < 20 || 0x0800 != be16(p))
+	    return NULL;
+	off = 20;
+	break;
+    default:
+	return NULL;
+    }
+    if (caplen < off + 20 || 4 != p[off] >> 4)
+	return NULL;
+    return p + off;
+}
+
+/*
+ * Set the timestamp resolution and offset of a pcapng interface from the
+ * options of its Interface Description Block.
+ */
+static void
+if_options(struct pcap_file *f, struct pcap_if *i, const unsigned char *p,
+    const unsigned char *end)
+{
+    while (p + 4 <= end) {
+	unsigned int code = rd16(f, p);
+	unsigned int len = rd16(f, p + 2);
+	p += 4;
+	if (0 == code || p + len > end)
+	    break;
+	if (OPT_IF_TSRESOL == code && len >= 1) {
+	    if (p[0] & 0x80)
+		i->tsunit = ldexp(1.0, -(p[0] & 0x7f));
+	    else
+		i->tsunit = pow(10.0, -p[0]);
+	} else if (OPT_IF_TSOFFSET == code && len >= 8) {
+	    long long off;
+	    memcpy(&off, p, 8);
+	    if (f->swapped)
+		off = (long long) ((unsigned long long) swap32(off) << 32 |
+		    swap32((unsigned long long) off >> 32));
+	    i->tsoffset = (double) off;
+	}
+	p += (len + 3) & ~3u;
+    }
+}
+
+/*
+ * Fill in 'pkt' from the packet at 'data'.  Returns 0 if the packet is not
+ * IPv4.
+ */
+static int
+packet(const struct pcap_if *i, double ts, const unsigned char *data,
+    unsigned int caplen, unsigned int wirelen, struct pcap_pkt *pkt)
+{
+    const unsigned char *ip = ip_header(i->linktype, data, caplen);
+    if (NULL == ip)
+	return 0;
+    pkt->time = ts * i->tsunit + i->tsoffset;
+    pkt->src = be32(ip + 12);
+    pkt->dst = be32(ip + 16);
+    pkt->len = be16(ip + 2);
+    if (0 == pkt->len)		/* segmentation offload */
+	pkt->len = wirelen - (ip - data);
+    return 1;
+}
+
+static int
+next_classic(struct pcap_file *f, struct pcap_pkt *pkt)
+{
+    while (f->p + 16 <= f->end) {
+	const unsigned char *h = f->p;
+	unsigned int caplen = rd32(f, h + 8);
+	if ((size_t) (f->end - h - 16) < caplen) {
+	    warnx("%s: truncated packet record", f->name);
+	    break;
+	}
+	f->p = h + 16 + caplen;
+	if (packet(&f->ifs[0], rd32(f, h) / f->ifs[0].tsunit + rd32(f, h + 4),
+		h + 16, caplen, rd32(f, h + 12), pkt))
+	    return 1;
+    }
+    f->p = f->end;
+    return 0;
+}
+
+static int
+next_ng(struct pcap_file *f, struct pcap_pkt *pkt)
+{
+    while (f->p + 12 <= f->end) {
+	const unsigned char *b = f->p;
+	unsigned int type;
+	unsigned int len;
+	const struct pcap_if *i;
+	unsigned int caplen;
+	unsigned int wirelen;
+	double ts;
+	memcpy(&type, b, 4);
+	if (PCAPNG_SHB == type) {
+	    /* each section sets its own byte order and interfaces */
+	    unsigned int bom;
+	    memcpy(&bom, b + 8, 4);
+	    f->swapped = PCAPNG_BYTE_ORDER != bom;
+	    if (f->swapped && PCAPNG_BYTE_ORDER != swap32(bom))
+		errx(1, "%s: bad section header", f->name);
+	    f->nifs = 0;
+	}
+	type = rd32(f, b);
+	len = rd32(f, b + 4);
+	if (len < 12 || (len & 3) || (size_t) (f->end - b) < len) {
+	    warnx("%s: truncated or corrupt block", f->name);
+	    break;
+	}
+	f->p = b + len;
+	switch (type) {
+	case PCAPNG_IDB:
+	    if (len < 20)
+		break;
+	    if_options(f, add_if(f, rd16(f, b + 8)), b + 16, b + len - 4);
+	    break;
+	case PCAPNG_EPB:
+	case PCAPNG_OPB:
+	    if (len < 32)
+		break;
+	    if (PCAPNG_EPB == type)
+		i = rd32(f, b + 8) < f->nifs ? &f->ifs[rd32(f, b + 8)] : NULL;
+	    else
+		i = rd16(f, b + 8) < f->nifs ? &f->ifs[rd16(f, b + 8)] : NULL;
+	    caplen = rd32(f, b + 20);
+	    wirelen = rd32(f, b + 24);
+	    if (NULL == i || caplen > len - 32)
+		break;
+	    ts = (double) rd32(f, b + 12) * 4294967296.0 + rd32(f, b + 16);
+	    if (packet(i, ts, b + 28, caplen, wirelen, pkt))
+		return 1;
+	    break;
+	case PCAPNG_SPB:
+	    /* no timestamp; the captured length is implied by the block */
+	    if (len < 16 || 0 == f->nifs)
+		break;
+	    wirelen = rd32(f, b + 8);
+	    caplen = len - 16 < wirelen ? len - 16 : wirelen;
+	    if (packet(&f->ifs[0], 0.0, b + 12, caplen, wirelen, pkt))
+		return 1;
+	    break;
+	}
+    }
+    f->p = f->end;
+    return 0;
+}
+
+/*
+ * Get the next IPv4 packet.  Returns 0 at end of file.
+ */
+int
+pcap_next(struct pcap_file *f, struct pcap_pkt *pkt)
+{
+    return f->ng ? next_ng(f, pkt) : next_classic(f, pkt);
+}
@@ -0,0 +1,41 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stddef.h>
+
+/*
+ * A capture file (pcap or pcapng) held in memory.  Packets are read in
+ * place; nothing is copied.
+ */
+struct pcap_if {
+    unsigned int linktype;
+    double tsunit;		/* seconds per timestamp tick */
+    double tsoffset;		/* seconds added to each timestamp */
+};
+
+struct pcap_file {
+    const char *name;
+    const unsigned char *p;
+    const unsigned char *end;
+    int swapped;		/* file byte order is not ours */
+    int ng;			/* pcapng, not classic pcap */
+    struct pcap_if *ifs;	/* classic pcap has exactly one */
+    unsigned int nifs;
+    unsigned int ifs_size;
+};
+
+/*
+ * One IPv4 packet.  'len' is the IP total length.
+ */
+struct pcap_pkt {
+    double time;
+    unsigned int src;
+    unsigned int dst;
+    unsigned int len;
+};
+
+void pcap_open(struct pcap_file *f, const char *name, const char *buf, size_t len);
+int pcap_next(struct pcap_file *f, struct pcap_pkt *pkt);
+void pcap_close(struct pcap_file *f);
+
+#endif
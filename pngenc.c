@@ -0,0 +1,348 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Multi-threaded PNG writer.  The image is cut into blocks of rows.  Each
+ * thread filters and deflates whole blocks on its own, priming zlib with
+ * the tail of the previous block so compression does not suffer at the
+ * seams.  The raw deflate pieces are then joined into one zlib stream, the
+ * same way pigz does it, with the Adler-32 checksums combined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "pngenc.h"
+
+#define PNG_BLOCK_BYTES (256 << 10)	/* filtered bytes per block, roughly */
+#define PNG_WINDOW 32768		/* deflate window */
+#define PNG_BPP 3			/* RGB; indexed images have one byte */
+
+struct png_block {
+    unsigned int y0;
+    unsigned int y1;
+    unsigned char *z;		/* raw deflate output */
+    size_t zlen;
+    uLong adler;
+    size_t len;			/* filtered bytes */
+};
+
+struct png_job {
+    unsigned int w;
+    unsigned int h;
+    unsigned int bpp;
+    int indexed;
+    pngenc_row_fn row;
+    void *arg;
+    struct png_block *blocks;
+    unsigned int nblocks;
+    int nthreads;
+    int tid;
+};
+
+static inline int
+paeth(int a, int b, int c)
+{
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2 * c);
+    int bc = pb <= pc ? b : c;
+    return pa <= pb && pa <= pc ? a : bc;
+}
+
+/* |(signed char) (x - p)|, the size of a filtered byte */
+#define ABSDIFF(x,p) abs((signed char) ((x) - (p)))
+
+/*
+ * Pick the filter with the smallest sum of absolute (signed) bytes, the
+ * usual heuristic, and filter one row with it.  'out' gets the filter
+ * type byte followed by 'n' filtered bytes.  The first pixel has nothing
+ * to its left, so it is done apart from the rest and the main loops stay
+ * simple enough to vectorize.
+ */
+static void
+filter_row(const unsigned char *prev, const unsigned char *cur, size_t n,
+    unsigned char *out)
+{
+    unsigned int sum[5];
+    unsigned int s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+    int best = 0;
+    int f;
+    size_t i;
+    for (i = 0; i < PNG_BPP; i++) {
+	int x = cur[i];
+	int b = prev[i];
+	s0 += ABSDIFF(x, 0);
+	s1 += ABSDIFF(x, 0);
+	s2 += ABSDIFF(x, b);
+	s3 += ABSDIFF(x, b >> 1);
+	s4 += ABSDIFF(x, b);
+    }
+    for (i = PNG_BPP; i < n; i++) {
+	int x = cur[i];
+	int a = cur[i - PNG_BPP];
+	int b = prev[i];
+	int c = prev[i - PNG_BPP];
+	s0 += ABSDIFF(x, 0);
+	s1 += ABSDIFF(x, a);
+	s2 += ABSDIFF(x, b);
+	s3 += ABSDIFF(x, (a + b) >> 1);
+	s4 += ABSDIFF(x, paeth(a, b, c));
+    }
+    sum[0] = s0;
+    sum[1] = s1;
+    sum[2] = s2;
+    sum[3] = s3;
+    sum[4] = s4;
+    for (f = 1; f < 5; f++)
+	if (sum[f] < sum[best])
+	    best = f;
+    *out++ = best;
+    for (i = 0; i < PNG_BPP; i++) {
+	int b = best >= 2 ? prev[i] : 0;
+	out[i] = cur[i] - (3 == best ? b >> 1 : b);
+    }
+    switch (best) {
+    case 0:
+	memcpy(out, cur, n);
+	break;
+    case 1:
+	for (i = PNG_BPP; i < n; i++)
+	    out[i] = cur[i] - cur[i - PNG_BPP];
+	break;
+    case 2:
+	for (i = PNG_BPP; i < n; i++)
+	    out[i] = cur[i] - prev[i];
+	break;
+    case 3:
+	for (i = PNG_BPP; i < n; i++)
+	    out[i] = cur[i] - ((cur[i - PNG_BPP] + prev[i]) >> 1);
+	break;
+    case 4:
+	for (i = PNG_BPP; i < n; i++)
+	    out[i] = cur[i] - paeth(cur[i - PNG_BPP], prev[i], prev[i - PNG_BPP]);
+	break;
+    }
+}
+
+/*
+ * Filter rows [y0, y1) into 'out'.  Filtering a row needs the row above,
+ * so the row before y0 is fetched too.
+ */
+static void
+filter_rows(const struct png_job *j, unsigned int y0, unsigned int y1,
+    unsigned char *out, unsigned char *rows[2])
+{
+    size_t n = (size_t) j->w * j->bpp;
+    unsigned int y;
+    int b = 0;
+    if (y0 > 0)
+	j->row(j->arg, y0 - 1, rows[1]);
+    else
+	memset(rows[1], 0, n);
+    for (y = y0; y < y1; y++) {
+	j->row(j->arg, y, rows[b]);
+	if (j->indexed) {
+	    /* filters rarely help palette images; none is the usual choice */
+	    out[0] = 0;
+	    memcpy(out + 1, rows[b], n);
+	} else
+	    filter_row(rows[b ^ 1], rows[b], n, out);
+	out += n + 1;
+	b ^= 1;
+    }
+}
+
+static void
+deflate_block(const struct png_job *j, struct png_block *blk, unsigned char *buf,
+    unsigned char *rows[2])
+{
+    size_t stride = (size_t) j->w * j->bpp + 1;
+    unsigned int dict_rows = (PNG_WINDOW + stride - 1) / stride;
+    unsigned int yd = blk->y0 > dict_rows ? blk->y0 - dict_rows : 0;
+    size_t dict_len = (blk->y0 - yd) * stride;
+    unsigned char *data = buf + dict_len;
+    z_stream zs;
+    int last = blk->y1 == j->h;
+    filter_rows(j, yd, blk->y1, buf, rows);
+    blk->len = (blk->y1 - blk->y0) * stride;
+    blk->adler = adler32(adler32(0L, Z_NULL, 0), data, blk->len);
+    memset(&zs, 0, sizeof(zs));
+    if (Z_OK != deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+	errx(1, "deflateInit2 failed");
+    if (dict_len > PNG_WINDOW) {
+	buf += dict_len - PNG_WINDOW;
+	dict_len = PNG_WINDOW;
+    }
+    if (dict_len && Z_OK != deflateSetDictionary(&zs, buf, dict_len))
+	errx(1, "deflateSetDictionary failed");
+    blk->zlen = deflateBound(&zs, blk->len) + 16;
+    blk->z = malloc(blk->zlen);
+    if (NULL == blk->z)
+	err(1, "png block");
+    zs.next_in = data;
+    zs.avail_in = blk->len;
+    zs.next_out = blk->z;
+    zs.avail_out = blk->zlen;
+    /*
+     * All but the last block end on a byte boundary with a sync flush.
+     * deflateBound() should leave room for all of it, but if the output
+     * fills up anyway, grow it and go on rather than lose the rest.
+     */
+    for (;;) {
+	int rc = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	size_t used;
+	if (Z_OK != rc && Z_STREAM_END != rc && Z_BUF_ERROR != rc)
+	    errx(1, "deflate failed");
+	if (last ? Z_STREAM_END == rc : 0 == zs.avail_in && 0 != zs.avail_out)
+	    break;
+	if (0 != zs.avail_out)
+	    errx(1, "deflate stopped short");
+	used = blk->zlen;
+	blk->zlen *= 2;
+	blk->z = realloc(blk->z, blk->zlen);
+	if (NULL == blk->z)
+	    err(1, "png block");
+	zs.next_out = blk->z + used;
+	zs.avail_out = blk->zlen - used;
+    }
+    blk->zlen -= zs.avail_out;
+    deflateEnd(&zs);
+}
+
+static void *
+encode_thread(void *arg)
+{
+    struct png_job *j = arg;
+    size_t stride = (size_t) j->w * j->bpp + 1;
+    unsigned int most = 0;
+    unsigned char *rows[2];
+    unsigned char *buf;
+    unsigned int b;
+    for (b = 0; b < j->nblocks; b++)
+	if (j->blocks[b].y1 - j->blocks[b].y0 > most)
+	    most = j->blocks[b].y1 - j->blocks[b].y0;
+    rows[0] = malloc(stride);
+    rows[1] = malloc(stride);
+    buf = malloc((most + (PNG_WINDOW + stride - 1) / stride) * stride);
+    if (NULL == rows[0] || NULL == rows[1] || NULL == buf)
+	err(1, "png buffers");
+    for (b = j->tid; b < j->nblocks; b += j->nthreads)
+	deflate_block(j, &j->blocks[b], buf, rows);
+    free(rows[0]);
+    free(rows[1]);
+    free(buf);
+    return NULL;
+}
+
+static void
+put32(unsigned char *p, unsigned long v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void
+write_chunk(FILE *fp, const char *type, const unsigned char *data, size_t len)
+{
+    unsigned char hdr[8];
+    unsigned char crc[4];
+    uLong c = crc32(0L, Z_NULL, 0);
+    put32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    c = crc32(c, hdr + 4, 4);
+    if (len)
+	c = crc32(c, data, len);
+    put32(crc, c);
+    if (1 != fwrite(hdr, 8, 1, fp) || (len && 1 != fwrite(data, len, 1, fp))
+	|| 1 != fwrite(crc, 4, 1, fp))
+	err(1, "png write");
+}
+
+/*
+ * Write a w x h image to 'fp', with rows supplied by 'row'.  The image is
+ * RGB if 'palette' is NULL, and otherwise indexed with 'ncolors' RGB
+ * triples in 'palette'.
+ */
+void
+pngenc_write(FILE *fp, unsigned int w, unsigned int h,
+    const unsigned char *palette, int ncolors,
+    pngenc_row_fn row, void *arg, int nthreads)
+{
+    static const unsigned char sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    static const unsigned char zhdr[2] = { 0x78, 0x9c };
+    unsigned int bpp = palette ? 1 : PNG_BPP;
+    size_t stride = (size_t) w * bpp + 1;
+    unsigned int rows_per_block = PNG_BLOCK_BYTES / stride + 1;
+    struct png_block *blocks;
+    struct png_job *jobs;
+    pthread_t *tids;
+    unsigned int nblocks = (h + rows_per_block - 1) / rows_per_block;
+    unsigned char ihdr[13];
+    unsigned char trailer[4];
+    uLong adler = adler32(0L, Z_NULL, 0);
+    unsigned int b;
+    int t;
+    if (nthreads < 1)
+	nthreads = 1;
+    blocks = calloc(nblocks, sizeof(*blocks));
+    jobs = calloc(nthreads, sizeof(*jobs));
+    tids = calloc(nthreads, sizeof(*tids));
+    if (NULL == blocks || NULL == jobs || NULL == tids)
+	err(1, "calloc");
+    for (b = 0; b < nblocks; b++) {
+	blocks[b].y0 = b * rows_per_block;
+	blocks[b].y1 = blocks[b].y0 + rows_per_block < h ? blocks[b].y0 + rows_per_block : h;
+    }
+    for (t = 0; t < nthreads; t++) {
+	jobs[t].w = w;
+	jobs[t].h = h;
+	jobs[t].bpp = bpp;
+	jobs[t].indexed = NULL != palette;
+	jobs[t].row = row;
+	jobs[t].arg = arg;
+	jobs[t].blocks = blocks;
+	jobs[t].nblocks = nblocks;
+	jobs[t].nthreads = nthreads;
+	jobs[t].tid = t;
+	if (0 != pthread_create(&tids[t], NULL, encode_thread, &jobs[t]))
+	    errx(1, "cannot start png thread");
+    }
+    for (t = 0; t < nthreads; t++)
+	pthread_join(tids[t], NULL);
+
+    if (1 != fwrite(sig, sizeof(sig), 1, fp))
+	err(1, "png write");
+    put32(ihdr, w);
+    put32(ihdr + 4, h);
+    ihdr[8] = 8;		/* bit depth */
+    ihdr[9] = palette ? 3 : 2;	/* color type indexed or RGB */
+    ihdr[10] = 0;		/* deflate */
+    ihdr[11] = 0;		/* adaptive filtering */
+    ihdr[12] = 0;		/* no interlace */
+    write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    if (palette)
+	write_chunk(fp, "PLTE", palette, ncolors * 3);
+    write_chunk(fp, "IDAT", zhdr, sizeof(zhdr));
+    for (b = 0; b < nblocks; b++) {
+	write_chunk(fp, "IDAT", blocks[b].z, blocks[b].zlen);
+	adler = adler32_combine(adler, blocks[b].adler, blocks[b].len);
+	free(blocks[b].z);
+    }
+    put32(trailer, adler);
+    write_chunk(fp, "IDAT", trailer, sizeof(trailer));
+    write_chunk(fp, "IEND", NULL, 0);
+    free(blocks);
+    free(jobs);
+    free(tids);
+}
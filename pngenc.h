@@ -0,0 +1,17 @@
+#ifndef PNGENC_H
+#define PNGENC_H
+
+#include <stdio.h>
+
+/*
+ * Fill 'out' with row 'y' of the image, 3 bytes (RGB) or 1 byte (palette
+ * index) per pixel.  Called from several threads at once, for rows in no
+ * particular order.
+ */
+typedef void (*pngenc_row_fn) (void *arg, unsigned int y, unsigned char *out);
+
+void pngenc_write(FILE *fp, unsigned int w, unsigned int h,
+    const unsigned char *palette, int ncolors,
+    pngenc_row_fn row, void *arg, int nthreads);
+
+#endif
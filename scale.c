@@ -0,0 +1,351 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Color scales.  An automatic scale (-l) is fitted to the counts when the
+ * map is rendered, from a histogram of the non-zero cells that is built in
+ * one pass.  Counts below SCALE_EXACT have a bin each; larger ones share
+ * bins with a 12 bit mantissa, which is far finer than 256 colors need.
+ *
+ *	linear	0 to the largest count
+ *	log	logarithmic, the smallest count to the largest, as -A/-B
+ *	pct	linear between the 1st and 99th percentile
+ *	equal	histogram equalized: each color covers as many cells as
+ *		the counts allow
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "ipv4-heatmap.h"
+#include "counts.h"
+#include "overlay.h"
+#include "scale.h"
+
+#define MANTISSA_BITS 12
+#define EXACT_BITS 16
+#define SCALE_BINS (SCALE_EXACT + (sizeof(count_t) * 8 - EXACT_BITS) * (1U << MANTISSA_BITS))
+
+enum {
+    SCALE_DIRECT,		/* the count is the color */
+    SCALE_LOG,
+    SCALE_LINEAR,
+    SCALE_PCT,
+    SCALE_EQUAL
+};
+
+static const char *scale_names[] = {"direct", "log", "linear", "pct", "equal"};
+
+int scale_auto = 0;
+
+static struct {
+    int mode;
+    double lo;			/* count at color 0 */
+    double hi;			/* count at the last color */
+    double C;			/* log scale factor, or 0 if lo == hi */
+    unsigned char *index;	/* equal: color of each bin */
+    count_t breaks[SCALE_COLORS];	/* equal: smallest count of each color */
+} s = {SCALE_DIRECT, 0.0, 0.0, 0.0, NULL, {0}};
+
+static inline size_t
+scale_bin(count_t c)
+{
+    int e;
+    if (c < SCALE_EXACT)
+	return c;
+    e = 63 - __builtin_clzll(c);
+    return SCALE_EXACT + ((size_t) (e - EXACT_BITS) << MANTISSA_BITS) +
+	((c >> (e - MANTISSA_BITS)) & ((1U << MANTISSA_BITS) - 1));
+}
+
+/*
+ * Smallest count that falls in bin 'b'
+ */
+static count_t
+bin_value(size_t b)
+{
+    int e;
+    if (b < SCALE_EXACT)
+	return b;
+    b -= SCALE_EXACT;
+    e = EXACT_BITS + (b >> MANTISSA_BITS);
+    return (count_t) ((1U << MANTISSA_BITS) | (b & ((1U << MANTISSA_BITS) - 1))) << (e - MANTISSA_BITS);
+}
+
+/*
+ * -l: fit a scale of kind 'name' to the counts at render time
+ */
+void
+scale_set(const char *name)
+{
+    int m;
+    for (m = SCALE_LOG; m <= SCALE_EQUAL; m++)
+	if (0 == strcmp(name, scale_names[m]))
+	    break;
+    if (m > SCALE_EQUAL)
+	errx(1, "unknown scale '%s'; use linear, log, pct or equal", name);
+    s.mode = m;
+    scale_auto = 1;
+}
+
+struct hist_job {
+    const count_t *grid;
+    count_t **pages;
+    size_t from;		/* cells of the grid, or pages */
+    size_t to;
+    uint64_t *hist;
+    count_t max;
+};
+
+static void *
+hist_thread(void *arg)
+{
+    struct hist_job *j = arg;
+    size_t i;
+    unsigned int c;
+    j->hist = calloc(SCALE_BINS, sizeof(*j->hist));
+    if (NULL == j->hist)
+	err(1, "calloc");
+    if (j->grid) {
+	for (i = j->from; i < j->to; i++) {
+	    count_t v = j->grid[i];
+	    if (0 == v)
+		continue;
+	    j->hist[scale_bin(v)]++;
+	    if (v > j->max)
+		j->max = v;
+	}
+	return NULL;
+    }
+    for (i = j->from; i < j->to; i++) {
+	const count_t *p = j->pages[i];
+	if (NULL == p)
+	    continue;
+	for (c = 0; c < counts_page_cells(); c++) {
+	    if (0 == p[c])
+		continue;
+	    j->hist[scale_bin(p[c])]++;
+	    if (p[c] > j->max)
+		j->max = p[c];
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Histogram of the non-zero cells of 'grid', or of 'pages', built by
+ * 'nthreads' threads.  Returns the number of cells counted.
+ */
+static uint64_t
+histogram(const count_t *grid, count_t **pages, int nthreads, uint64_t *hist, count_t *max)
+{
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    struct hist_job *jobs = calloc(nthreads, sizeof(*jobs));
+    size_t n = grid ? counts_cells() : counts_pages();
+    uint64_t total = 0;
+    size_t b;
+    int t;
+    if (NULL == tids || NULL == jobs)
+	err(1, "calloc");
+    for (t = 0; t < nthreads; t++) {
+	jobs[t].grid = grid;
+	jobs[t].pages = pages;
+	jobs[t].from = n * t / nthreads;
+	jobs[t].to = n * (t + 1) / nthreads;
+	if (0 != pthread_create(&tids[t], NULL, hist_thread, &jobs[t]))
+	    errx(1, "cannot start histogram thread");
+    }
+    *max = 0;
+    for (t = 0; t < nthreads; t++) {
+	pthread_join(tids[t], NULL);
+	for (b = 0; b < SCALE_BINS; b++)
+	    hist[b] += jobs[t].hist[b];
+	if (jobs[t].max > *max)
+	    *max = jobs[t].max;
+	free(jobs[t].hist);
+    }
+    for (b = 0; b < SCALE_BINS; b++)
+	total += hist[b];
+    free(tids);
+    free(jobs);
+    return total;
+}
+
+/*
+ * Smallest count with more than 'rank' cells at or below it
+ */
+static count_t
+rank_value(const uint64_t *hist, uint64_t rank)
+{
+    uint64_t below = 0;
+    size_t b;
+    for (b = 1; b < SCALE_BINS; b++) {
+	below += hist[b];
+	if (below > rank)
+	    return bin_value(b);
+    }
+    return 0;
+}
+
+/*
+ * Color of each bin so that the colors split the cells evenly, as far as
+ * the bins allow: a bin gets the color of the middle of its cells
+ */
+static void
+equalize(const uint64_t *hist, uint64_t total)
+{
+    uint64_t below = 0;
+    size_t b;
+    int k = 0;
+    if (NULL == s.index) {
+	s.index = malloc(SCALE_BINS);
+	if (NULL == s.index)
+	    err(1, "malloc");
+    }
+    memset(s.index, 0, SCALE_BINS);
+    memset(s.breaks, 0, sizeof(s.breaks));
+    for (b = 1; b < SCALE_BINS; b++) {
+	int i;
+	if (0 == hist[b]) {
+	    s.index[b] = k;
+	    continue;
+	}
+	i = (int) ((SCALE_COLORS - 1) * (below + hist[b] / 2.0) / total + 0.5);
+	if (0 == below)
+	    s.breaks[0] = bin_value(b);
+	for (; k < i; k++)
+	    s.breaks[k + 1] = bin_value(b);
+	s.index[b] = k = i;
+	below += hist[b];
+    }
+    for (; k < SCALE_COLORS - 1; k++)
+	s.breaks[k + 1] = s.hi;
+}
+
+/*
+ * Fit the scale to the counts about to be rendered, either the flat
+ * 'grid' or the page table 'pages'.  Fixed scales need nothing.
+ */
+void
+scale_prepare(const count_t *grid, count_t **pages, int nthreads)
+{
+    uint64_t *hist;
+    uint64_t total;
+    count_t max;
+    if (!scale_auto) {
+	s.mode = 0.0 != log_A ? SCALE_LOG : SCALE_DIRECT;
+	s.lo = log_A;
+	s.hi = log_B;
+	s.C = log_C;
+	return;
+    }
+    hist = calloc(SCALE_BINS, sizeof(*hist));
+    if (NULL == hist)
+	err(1, "calloc");
+    total = histogram(grid, pages, nthreads, hist, &max);
+    s.lo = 0.0;
+    s.hi = max;
+    switch (s.mode) {
+    case SCALE_LOG:
+	s.lo = rank_value(hist, 0);
+	break;
+    case SCALE_PCT:
+	s.lo = rank_value(hist, total / 100);
+	s.hi = rank_value(hist, total - 1 - total / 100);
+	break;
+    case SCALE_EQUAL:
+	equalize(hist, total);
+	break;
+    }
+    if (s.lo < 1.0 && SCALE_LOG == s.mode)
+	s.lo = 1.0;
+    s.C = s.hi > s.lo ? (SCALE_COLORS - 1) / (SCALE_LOG == s.mode ? log(s.hi / s.lo) : s.hi - s.lo) : 0.0;
+    if (debug)
+	fprintf(stderr, "scale: %s, %" PRIu64 " cells, %g to %g\n",
+	    scale_names[s.mode], total, s.lo, s.hi);
+    free(hist);
+}
+
+/*
+ * Index into colors[] for a non-zero count
+ */
+int
+scale_index(count_t c)
+{
+    int k;
+    switch (s.mode) {
+    case SCALE_DIRECT:
+	return c < SCALE_COLORS ? (int) c : SCALE_COLORS - 1;
+    case SCALE_EQUAL:
+	return s.index[scale_bin(c)];
+    case SCALE_LOG:
+	if (0.0 == s.C)
+	    return SCALE_COLORS - 1;
+	k = (int) ((s.C * log((double) c / s.lo)) + 0.5);
+	break;
+    default:
+	if (0.0 == s.C)
+	    return c < s.lo ? 0 : SCALE_COLORS - 1;
+	k = (int) (s.C * ((double) c - s.lo) + 0.5);
+	break;
+    }
+    if (k < 0)
+	k = 0;
+    if (k >= SCALE_COLORS)
+	k = SCALE_COLORS - 1;
+    return k;
+}
+
+/*
+ * Legend label for color 'k' (which need not be whole): the percentage
+ * for the direct scale, otherwise the count there
+ */
+void
+scale_label(double k, char *buf, size_t len)
+{
+    double v;
+    switch (s.mode) {
+    case SCALE_DIRECT:
+	snprintf(buf, len, "%d%%", (int) (k * 100 / (SCALE_COLORS - 1) + 0.5));
+	return;
+    case SCALE_EQUAL:
+	v = s.breaks[(int) ceil(k)];
+	break;
+    case SCALE_LOG:
+	v = 0.0 == s.C ? s.hi : s.lo * exp(k / s.C);
+	break;
+    default:
+	v = 0.0 == s.C ? s.hi : s.lo + k / s.C;
+	break;
+    }
+    if (v < 100000.0)
+	snprintf(buf, len, "%d", (int) (v + 0.5));
+    else if (v < 1e9)
+	snprintf(buf, len, v < 1e6 ? "%.0fk" : "%.1fM", v < 1e6 ? v / 1e3 : v / 1e6);
+    else
+	snprintf(buf, len, "%.1fG", v / 1e9);
+}
+
+/*
+ * Hash of everything the legend labels are drawn from, so that an overlay
+ * drawn for one fit is not used with another
+ */
+uint64_t
+scale_fingerprint(void)
+{
+    double d[] = {s.lo, s.hi, s.C};
+    uint64_t h = overlay_hash(OVERLAY_HASH_INIT, &s.mode, sizeof(s.mode));
+    h = overlay_hash(h, d, sizeof(d));
+    if (SCALE_EQUAL == s.mode)
+	h = overlay_hash(h, s.breaks, sizeof(s.breaks));
+    return h;
+}
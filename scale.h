@@ -0,0 +1,23 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "counts.h"
+
+/*
+ * Mapping of pixel counts to the NUM_DATA_COLORS data colors.  By default
+ * a count is the color index itself; -A/-B give a fixed logarithmic
+ * scale, and -l one fitted to the counts each time the map is rendered.
+ */
+#define SCALE_COLORS 256
+#define SCALE_EXACT 65536	/* counts below this get a table entry each */
+
+void scale_set(const char *name);
+void scale_prepare(const count_t *grid, count_t **pages, int nthreads);
+int scale_index(count_t c);
+void scale_label(double k, char *buf, size_t len);
+uint64_t scale_fingerprint(void);
+extern int scale_auto;
+
+#endif
@@ -17,22 +17,51 @@
 
 #include <gd.h>
 #include "bbox.h"
+#include "cidr.h"
 #include "ipv4-heatmap.h"
 
 
+struct shade {
+    gdImagePtr image;
+    unsigned int rgb;
+    int alpha;
+    int color;
+};
+
+static void
+shade_block(bbox box, void *arg)
+{
+    struct shade *sh = arg;
+    box = bbox_in_view(box);
+    if (!bbox_visible(box, sh->image, 0))
+	return;
+    if (sh->color < 0)
+	sh->color = gdImageColorAllocateAlpha(sh->image,
+	    sh->rgb >> 16,
+	    (sh->rgb >> 8) & 0xFF,
+	    sh->rgb & 0xFF,
+	    sh->alpha);
+    bbox_fill(box, sh->image, sh->color);
+}
+
+/*
+ * Fill exactly the pixels the prefix covers, including the part of a
+ * prefix that is only partly inside the rendered space
+ */
 static void
 shade_cidr(gdImagePtr image, const char *cidr, unsigned int rgb, int alpha)
 {
-    bbox box = bbox_from_cidr(cidr);
-    int color = gdImageColorAllocateAlpha(image,
-	rgb >> 16,
-	(rgb >> 8) & 0xFF,
-	rgb & 0xFF,
-	alpha);
-    if (box.xmin != box.xmax || box.ymin != box.ymax)
-	bbox_draw_filled(box, image, color);
-    else
-	bbox_draw_outline(box, image, color);
+    struct shade sh;
+    unsigned int first;
+    unsigned int last;
+    int slash;
+    if (!cidr_parse(cidr, &first, &last, &slash))
+	return;
+    sh.image = image;
+    sh.rgb = rgb;
+    sh.alpha = alpha;
+    sh.color = -1;
+    bbox_blocks(first, last, bbox_view.shift, shade_block, &sh);
 }
 
 /*
@@ -0,0 +1,265 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Count grid snapshots.  A snapshot saved at the end of one run can be
+ * loaded as the starting state of the next, so a cumulative map only
+ * needs the new input.  The geometry is stored with the grid and must
+ * match the options of the run that loads it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ipv4-heatmap.h"
+#include "xy_from_ip.h"
+#include "counts.h"
+#include "snapshot.h"
+
+const char *snapshot_file = NULL;	/* -S */
+volatile sig_atomic_t snapshot_requested = 0;
+
+static void
+snapshot_fill(struct snapshot_header *h)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+    h->version = SNAPSHOT_VERSION;
+    h->byte_order = SNAPSHOT_BYTE_ORDER;
+    h->count_bytes = sizeof(count_t);
+    h->order = count_grid_order;
+    h->bits_per_pixel = addr_space_bits_per_pixel;
+    h->first_addr = addr_space_first_addr;
+    h->last_addr = addr_space_last_addr;
+    h->morton = morton_flag;
+    h->transpose = transpose_flag;
+    h->paged = NULL != count_pages;
+    h->grid_offset = SNAPSHOT_HEADER_SIZE;
+    h->cells = counts_cells();
+}
+
+/*
+ * Page p of the paged layout, as rows of the dense one
+ */
+static count_t *
+grid_page(count_t *grid, size_t p)
+{
+    int shift = count_grid_order - count_page_order;
+    size_t px = p & (((size_t) 1 << shift) - 1);
+    size_t py = p >> shift;
+    return grid + ((py << count_page_order) << count_grid_order) + (px << count_page_order);
+}
+
+static void
+page_from_grid(count_t *page, const count_t *grid)
+{
+    unsigned int size = 1U << count_page_order;
+    unsigned int y;
+    for (y = 0; y < size; y++)
+	memcpy(page + y * size, grid + ((size_t) y << count_grid_order), size * sizeof(count_t));
+}
+
+static void
+page_to_grid(count_t *grid, const count_t *page)
+{
+    unsigned int size = 1U << count_page_order;
+    unsigned int y;
+    for (y = 0; y < size; y++)
+	memcpy(grid + ((size_t) y << count_grid_order), page + y * size, size * sizeof(count_t));
+}
+
+/*
+ * Fill the paged store from a dense grid, allocating only pages that have
+ * counts
+ */
+static void
+load_dense_pages(const count_t *grid)
+{
+    count_t *tmp = counts_page_alloc();
+    size_t p;
+    for (p = 0; p < counts_pages(); p++) {
+	size_t c;
+	page_from_grid(tmp, grid_page((count_t *) grid, p));
+	for (c = 0; c < counts_page_cells(); c++)
+	    if (tmp[c])
+		break;
+	if (c == counts_page_cells())
+	    continue;
+	count_pages[p] = tmp;
+	tmp = counts_page_alloc();
+    }
+    counts_page_free(tmp);
+}
+
+static void
+load_pages(const char *path, const char *map, size_t size, const struct snapshot_header *h)
+{
+    const uint64_t *offsets = (const uint64_t *) (map + h->grid_offset);
+    size_t bytes = counts_page_cells() * sizeof(count_t);
+    size_t p;
+    if (size < h->grid_offset + counts_pages() * sizeof(*offsets))
+	errx(1, "%s: truncated snapshot", path);
+    for (p = 0; p < counts_pages(); p++) {
+	count_t *page;
+	if (0 == offsets[p])
+	    continue;
+	if (offsets[p] > size || size - offsets[p] < bytes)
+	    errx(1, "%s: truncated snapshot", path);
+	if (count_pages) {
+	    page = count_pages[p] = counts_page_alloc();
+	    memcpy(page, map + offsets[p], bytes);
+	} else
+	    page_to_grid(grid_page(count_grid, p), (const count_t *) (map + offsets[p]));
+    }
+}
+
+static void
+snapshot_check(const char *path, const struct snapshot_header *h,
+    const struct snapshot_header *want)
+{
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)))
+	errx(1, "%s: not a snapshot file", path);
+    if (h->version != SNAPSHOT_VERSION)
+	errx(1, "%s: snapshot version %u, expected %u", path, h->version, SNAPSHOT_VERSION);
+    if (h->byte_order != SNAPSHOT_BYTE_ORDER)
+	errx(1, "%s: snapshot was written with a different byte order", path);
+    if (h->count_bytes != want->count_bytes)
+	errx(1, "%s: snapshot has %u-byte counts, expected %u", path,
+	    h->count_bytes, want->count_bytes);
+    if (h->order != want->order || h->bits_per_pixel != want->bits_per_pixel)
+	errx(1, "%s: snapshot geometry (order %u, %u bits per pixel) does not match",
+	    path, h->order, h->bits_per_pixel);
+    if (h->first_addr != want->first_addr || h->last_addr != want->last_addr)
+	errx(1, "%s: snapshot covers a different address space (-y)", path);
+    if (h->morton != want->morton || h->transpose != want->transpose)
+	errx(1, "%s: snapshot uses a different curve (-m, -T)", path);
+    if (h->cells != want->cells || h->grid_offset < sizeof(*h) || h->paged > 1)
+	errx(1, "%s: corrupt snapshot header", path);
+}
+
+/*
+ * Replace the count grid with the contents of a snapshot.  Either kind of
+ * snapshot loads into either kind of grid.
+ */
+void
+snapshot_load(const char *path)
+{
+    struct snapshot_header want;
+    const struct snapshot_header *h;
+    struct stat sb;
+    size_t bytes = counts_cells() * sizeof(count_t);
+    char *map;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+	err(1, "%s", path);
+    if (fstat(fd, &sb) < 0)
+	err(1, "%s", path);
+    if ((size_t) sb.st_size < sizeof(*h))
+	errx(1, "%s: not a snapshot file", path);
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == map)
+	err(1, "%s: mmap", path);
+    close(fd);
+    h = (const struct snapshot_header *) map;
+    snapshot_fill(&want);
+    snapshot_check(path, h, &want);
+    if (h->paged)
+	load_pages(path, map, sb.st_size, h);
+    else if ((size_t) sb.st_size < h->grid_offset + bytes)
+	errx(1, "%s: truncated snapshot", path);
+    else if (count_pages)
+	load_dense_pages((const count_t *) (map + h->grid_offset));
+    else
+	memcpy(count_grid, map + h->grid_offset, bytes);
+    munmap(map, sb.st_size);
+    if (debug)
+	fprintf(stderr, "%s: loaded %zu cells\n", path, counts_cells());
+}
+
+static void
+save_pages(const char *path, FILE *fp)
+{
+    uint64_t *offsets = calloc(counts_pages(), sizeof(*offsets));
+    uint64_t off = SNAPSHOT_HEADER_SIZE + counts_pages() * sizeof(*offsets);
+    size_t p;
+    if (NULL == offsets)
+	err(1, "calloc");
+    for (p = 0; p < counts_pages(); p++) {
+	if (NULL == count_pages[p])
+	    continue;
+	offsets[p] = off;
+	off += counts_page_cells() * sizeof(count_t);
+    }
+    if (counts_pages() != fwrite(offsets, sizeof(*offsets), counts_pages(), fp))
+	err(1, "%s", path);
+    for (p = 0; p < counts_pages(); p++)
+	if (count_pages[p] &&
+	    counts_page_cells() != fwrite(count_pages[p], sizeof(count_t), counts_page_cells(), fp))
+	    err(1, "%s", path);
+    free(offsets);
+}
+
+/*
+ * Write the count grid to 'path'.  The snapshot goes to a temporary file that
+ * is renamed into place, so a reader never sees a partial one, and a run
+ * may save over the snapshot it loaded.
+ */
+void
+snapshot_save(const char *path)
+{
+    char header[SNAPSHOT_HEADER_SIZE];
+    char *tmp;
+    FILE *fp;
+    size_t len = strlen(path) + 8;
+    memset(header, 0, sizeof(header));
+    snapshot_fill((struct snapshot_header *) header);
+    tmp = malloc(len);
+    if (NULL == tmp)
+	err(1, "malloc");
+    snprintf(tmp, len, "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (NULL == fp)
+	err(1, "%s", tmp);
+    if (1 != fwrite(header, sizeof(header), 1, fp))
+	err(1, "%s", tmp);
+    if (count_pages)
+	save_pages(tmp, fp);
+    else if (counts_cells() != fwrite(count_grid, sizeof(count_t), counts_cells(), fp))
+	err(1, "%s", tmp);
+    if (0 != fclose(fp))
+	err(1, "%s", tmp);
+    if (rename(tmp, path) < 0)
+	err(1, "rename %s", tmp);
+    free(tmp);
+    if (debug)
+	fprintf(stderr, "%s: saved %zu cells\n", path, counts_cells());
+}
+
+/*
+ * SIGUSR1 during a long run writes the -S snapshot as it stands.  The
+ * handler only raises a flag; the input loop writes the snapshot.
+ */
+void
+snapshot_signal(int sig)
+{
+    snapshot_requested = 1;
+}
+
+void
+snapshot_checkpoint(void)
+{
+    snapshot_requested = 0;
+    snapshot_save(snapshot_file);
+}
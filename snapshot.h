@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <signal.h>
+
+/*
+ * A snapshot file is a page-sized header followed by the count grid in
+ * native byte order, so the grid can be mapped straight from the file.
+ * A paged grid is stored as a table of file offsets, one per page (0 for
+ * a page that was never touched), followed by the pages themselves.
+ */
+#define SNAPSHOT_MAGIC "IPv4HMap"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_HEADER_SIZE 4096
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t count_bytes;	/* sizeof(count_t) */
+    uint32_t order;
+    uint32_t bits_per_pixel;
+    uint32_t first_addr;	/* -y crop */
+    uint32_t last_addr;
+    uint32_t morton;
+    uint32_t transpose;
+    uint32_t paged;		/* grid stored as pages */
+    uint64_t grid_offset;
+    uint64_t cells;
+};
+
+void snapshot_load(const char *path);
+void snapshot_save(const char *path);
+void snapshot_checkpoint(void);
+void snapshot_signal(int sig);
+extern const char *snapshot_file;
+extern volatile sig_atomic_t snapshot_requested;
+
+/*
+ * Write a checkpoint if SIGUSR1 asked for one.  Only called where
+ * count_grid holds everything read so far.
+ */
+#define SNAPSHOT_POLL() do { if (snapshot_requested) snapshot_checkpoint(); } while (0)
+
+#endif
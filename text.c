@@ -16,12 +16,145 @@
 #include <err.h>
 
 #include <gd.h>
+#include <gdfontt.h>
+#include <gdfonts.h>
+#include <gdfontmb.h>
+#include <gdfontl.h>
+#include <gdfontg.h>
+#if HAVE_FONTCONFIG
+#include <fontconfig/fontconfig.h>
+#endif
 #include "ipv4-heatmap.h"
 #include "bbox.h"
 #include "text.h"
 
 double _text_last_sz = 0.0;
 
+/*
+ * The font file every text call uses, resolved once by text_font_init().
+ * NULL means the built-in bitmap fonts are used instead.
+ */
+static char *font_file = NULL;
+static int font_resolved = 0;
+
+#define METRICS_BUCKETS 1024
+#define MIN_SIZE 6.0
+
+/*
+ * FreeType layouts are the expensive part of placing text, and the same
+ * labels are measured at the same sizes over and over (every frame of an
+ * animation, every tile), so measurements are remembered.
+ */
+struct metrics {
+    char *font;
+    char *text;
+    double sz;
+    int brect[8];
+    struct metrics *next;
+};
+
+static struct metrics *metrics_cache[METRICS_BUCKETS];
+
+static unsigned int
+metrics_hash(const char *font, const char *text, double sz)
+{
+    unsigned int h = 2166136261U;
+    const char *s;
+    for (s = font; *s; s++)
+	h = (h ^ (unsigned char)*s) * 16777619U;
+    for (s = text; *s; s++)
+	h = (h ^ (unsigned char)*s) * 16777619U;
+    return (h ^ (unsigned int)(sz * 64.0)) % METRICS_BUCKETS;
+}
+
+/*
+ * Find the file for a fontconfig name such as "Luxi Mono:style=Regular",
+ * and which face in it, for collections (.ttc, .otc) and named instances
+ */
+static char *
+font_match(const char *name, int *face)
+{
+    char *file = NULL;
+#if HAVE_FONTCONFIG
+    FcPattern *pat;
+    FcPattern *match;
+    FcResult result;
+    FcChar8 *f;
+    *face = 0;
+    if (!FcInit())
+	return NULL;
+    pat = FcNameParse((const FcChar8 *)name);
+    if (NULL == pat)
+	return NULL;
+    FcConfigSubstitute(NULL, pat, FcMatchPattern);
+    FcDefaultSubstitute(pat);
+    match = FcFontMatch(NULL, pat, &result);
+    if (match && FcResultMatch == FcPatternGetString(match, FC_FILE, 0, &f)) {
+	file = strdup((const char *)f);
+	if (FcResultMatch != FcPatternGetInteger(match, FC_INDEX, 0, face))
+	    *face = 0;
+    }
+    if (match)
+	FcPatternDestroy(match);
+    FcPatternDestroy(pat);
+#endif
+    return file;
+}
+
+/*
+ * Resolve -f to a font file once, so fontconfig does not match the name
+ * again on every text call.  A pathname is used as is.  With -f builtin,
+ * or when the font cannot be found or loaded, text is drawn in libgd's
+ * built-in bitmap fonts.  libgd always draws the first face of a file, so
+ * a name that fontconfig finds in a later face of a collection gets the
+ * built-in fonts too, rather than some other face.
+ */
+void
+text_font_init(void)
+{
+    int brect[8];
+    char *errmsg;
+    int face = 0;
+    if (font_resolved)
+	return;
+    font_resolved = 1;
+    if (0 == strcmp(font_file_or_name, "builtin"))
+	return;
+    if (strchr(font_file_or_name, '/') || 0 == access(font_file_or_name, R_OK))
+	font_file = strdup(font_file_or_name);
+    else
+	font_file = font_match(font_file_or_name, &face);
+    if (NULL == font_file) {
+	warnx("%s: font not found, using built-in fonts", font_file_or_name);
+	return;
+    }
+    if (0 != face) {
+	warnx("%s: face %d of %s, which libgd cannot draw, using built-in fonts",
+	    font_file_or_name, face, font_file);
+	free(font_file);
+	font_file = NULL;
+	return;
+    }
+    gdFontCacheSetup();
+    errmsg = gdImageStringFT(NULL, &brect[0], 0, font_file, 12.0, 0.0, 0, 0, "ABCD");
+    if (NULL != errmsg) {
+	warnx("%s: %s, using built-in fonts", font_file, errmsg);
+	free(font_file);
+	font_file = NULL;
+	return;
+    }
+    if (debug)
+	fprintf(stderr, "font %s is %s\n", font_file_or_name, font_file);
+}
+
+/*
+ * The font file text is drawn in, or NULL for the built-in fonts
+ */
+const char *
+text_font_file(void)
+{
+    return font_file;
+}
 
 /*
  * Calculate the width and height of some text draw at some size
@@ -29,15 +162,97 @@ double _text_last_sz = 0.0;
 static int *
 text_width_height(const char *text, double sz, int *w, int *h)
 {
-    static int brect[8];
-    char *errmsg = gdImageStringFT(NULL, &brect[0], 0,
-	(char *)font_file_or_name,
-	sz, 0.0, 0, 0, (char *)text);
-    if (NULL != errmsg)
-	errx(1, "%s", errmsg);
-    *w = brect[2] - brect[0];
-    *h = brect[3] - brect[5];
-    return &brect[0];
+    const char *font = font_file;
+    unsigned int b = metrics_hash(font, text, sz);
+    struct metrics *m;
+    char *errmsg;
+    for (m = metrics_cache[b]; m; m = m->next)
+	if (m->sz == sz && 0 == strcmp(m->text, text) && 0 == strcmp(m->font, font))
+	    break;
+    if (NULL == m) {
+	m = calloc(1, sizeof(*m));
+	if (NULL == m)
+	    err(1, "calloc");
+	errmsg = gdImageStringFT(NULL, &m->brect[0], 0, (char *)font, sz, 0.0, 0, 0, (char *)text);
+	if (NULL != errmsg)
+	    errx(1, "%s", errmsg);
+	m->font = strdup(font);
+	m->text = strdup(text);
+	if (NULL == m->font || NULL == m->text)
+	    err(1, "strdup");
+	m->sz = sz;
+	m->next = metrics_cache[b];
+	metrics_cache[b] = m;
+    }
+    *w = m->brect[2] - m->brect[0];
+    *h = m->brect[3] - m->brect[5];
+    return &m->brect[0];
+}
+
+/*
+ * Draw 'text' in the largest built-in font that fits the box, and is no
+ * taller than 'maxsize' points would be
+ */
+static void
+text_builtin(gdImagePtr image, const char *text, bbox box, int color, double maxsize)
+{
+    gdFontPtr fonts[5];
+    gdFontPtr f = NULL;
+    int nlines = 1;
+    int maxlen = 0;
+    int len = 0;
+    int i;
+    const char *s;
+    int y;
+    fonts[0] = gdFontGetGiant();
+    fonts[1] = gdFontGetLarge();
+    fonts[2] = gdFontGetMediumBold();
+    fonts[3] = gdFontGetSmall();
+    fonts[4] = gdFontGetTiny();
+    for (s = text; *s; s++) {
+	if ('\n' == *s) {
+	    nlines++;
+	    len = 0;
+	} else if (++len > maxlen) {
+	    maxlen = len;
+	}
+    }
+    for (i = 0; i < 5 && NULL == f; i++) {
+	if (fonts[i]->h * 3 > maxsize * 4)
+	    continue;
+	if (fonts[i]->w * maxlen > ((box.xmax - box.xmin) * 95 / 100))
+	    continue;
+	if (fonts[i]->h * nlines > ((box.ymax - box.ymin) * 95 / 100))
+	    continue;
+	f = fonts[i];
+    }
+    if (NULL == f)
+	return;
+    y = (box.ymin + box.ymax) / 2 - f->h * nlines / 2;
+    for (s = text; *s; y += f->h) {
+	char line[512];
+	len = strcspn(s, "\n");
+	snprintf(line, sizeof(line), "%.*s", len, s);
+	gdImageString(image, f,
+	    (box.xmin + box.xmax) / 2 - f->w * (int)strlen(line) / 2, y,
+	    (unsigned char *)line, color);
+	s += len;
+	if ('\n' == *s)
+	    s++;
+    }
+    _text_last_sz = f->h;
+}
+
+static int
+text_fits(const char *text, double sz, bbox box)
+{
+    int tw, th;
+    (void)text_width_height(text, sz, &tw, &th);
+    if (tw > ((box.xmax - box.xmin) * 95 / 100))
+	return 0;
+    if (th > ((box.ymax - box.ymin) * 95 / 100))
+	return 0;
+    return 1;
 }
 
 
@@ -45,20 +260,26 @@ text_width_height(const char *text, double sz, int *w, int *h)
  * Draws 'text' inside the bbox bounding box with color color. The text is
  * sized to be as large as possible and still fit within the box.
  *
- * If the optional 'text2' is given, then it is drawn below the first text, always
- * in a 12-point size.  This is mainly to print the CIDR prefix values
- * underneath their owner names in each /8 box.
+ * Sizes are tried from 'maxsize' down in 10% steps.  Text scales about
+ * linearly with its size, so one measurement at 'maxsize' predicts the
+ * step that fits, and only the steps around that are measured to find it
+ * exactly.
  */
 void
 text_in_bbox(gdImagePtr image, const char *text, bbox box, int color, double maxsize)
 {
+    double sizes[64];
+    int n = 0;
+    int k;
     double sz;
     int tw, th;
     int oneline_h;
-    int *brectPtr;
+    int brect[8];
     char *text_copy = calloc(1, strlen(text) + 1);
     const char *s;
     char *d;
+    if (NULL == text_copy)
+	err(1, "calloc");
     /*
      * convert newlines
      */
@@ -70,19 +291,50 @@ text_in_bbox(gdImagePtr image, const char *text, bbox box, int color, double max
     }
     if (maxsize < 1.0)
 	maxsize = 128.0;
-    for (sz = maxsize; sz > 6.0; sz *= 0.9) {
+    text_font_init();
+    if (NULL == font_file) {
+	text_builtin(image, text_copy, box, color, maxsize);
+	free(text_copy);
+	return;
+    }
+    for (sz = maxsize; sz > MIN_SIZE && n < 64; sz *= 0.9)
+	sizes[n++] = sz;
+    if (0 == n) {
+	free(text_copy);
+	return;
+    }
+    /*
+     * guess the step from the size at maxsize, then walk to the largest
+     * size that fits
+     */
+    (void)text_width_height(text_copy, sizes[0], &tw, &th);
+    k = 0;
+    if (tw > 0 && th > 0) {
+	double sx = (box.xmax - box.xmin) * 0.95 / tw;
+	double sy = (box.ymax - box.ymin) * 0.95 / th;
+	double scale = sx < sy ? sx : sy;
+	while (k < n - 1 && scale < 1.0) {
+	    scale /= 0.9;
+	    k++;
+	}
+    }
+    if (text_fits(text_copy, sizes[k], box)) {
+	while (k > 0 && text_fits(text_copy, sizes[k - 1], box))
+	    k--;
+    } else {
+	while (k < n && !text_fits(text_copy, sizes[k], box))
+	    k++;
+    }
+    if (k < n) {
+	sz = sizes[k];
 	(void)text_width_height("ABCD", sz, &tw, &oneline_h);
-	brectPtr = text_width_height(text_copy, sz, &tw, &th);
-	if (tw > ((box.xmax - box.xmin) * 95 / 100))
-	    continue;
-	if (th > ((box.ymax - box.ymin) * 95 / 100))
-	    continue;
-	gdImageStringFT(image, brectPtr, color,
-	    (char *)font_file_or_name, sz, 0.0,
+	memcpy(brect, text_width_height(text_copy, sz, &tw, &th), sizeof(brect));
+	gdImageStringFT(image, brect, color,
+	    font_file, sz, 0.0,
 	    ((box.xmin + box.xmax) / 2) - (tw / 2),
 	    ((box.ymin + box.ymax) / 2) - (th / 2) + oneline_h,
 	    text_copy);
 	_text_last_sz = sz;
-	break;
     }
+    free(text_copy);
 }
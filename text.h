@@ -1,3 +1,5 @@
+void text_font_init(void);
+const char *text_font_file(void);
 void text_in_bbox(gdImagePtr image, const char *text, bbox box, int color, double maxsize);
 extern int _text_last_height;
 extern double _text_last_sz;
@@ -0,0 +1,261 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Slippy map tile pyramid.  The deepest zoom level is the paged count
+ * store itself, one cell per tile pixel.  Each coarser level sums 2x2
+ * cells of the level below, which is the map a -z two bits larger would
+ * draw, and is kept in pages the same way, so an empty part of the map
+ * costs nothing at any level.  Levels are written deepest first, and each
+ * is freed once the next has been summed from it, so at most two levels
+ * are held at a time.  Tiles are handed out to a pool of threads from one
+ * queue, and tiles with no counts at all are not written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ipv4-heatmap.h"
+#include "counts.h"
+#include "tiles.h"
+
+#define MAX_ZOOM 16
+
+/*
+ * A zoom level is n x n pages of the count store's page size.  Pages
+ * where the level has no counts are NULL.
+ */
+struct level {
+    count_t **pages;
+    unsigned int n;
+};
+
+struct tiles_job {
+    pthread_mutex_t lock;
+    unsigned int next;
+    unsigned int n;
+    void (*item) (struct tiles_job *, unsigned int);
+    struct level *levels;
+    int zmax;
+    int z;			/* level being summed or written */
+    const char *dir;
+    tiles_write_fn fn;
+    unsigned int written;
+};
+
+/*
+ * Tile width and height, which is smaller than TILE_SIZE only when the
+ * whole map is
+ */
+unsigned int
+tiles_size(void)
+{
+    return count_grid_size < TILE_SIZE ? count_grid_size : TILE_SIZE;
+}
+
+static void *
+tiles_thread(void *arg)
+{
+    struct tiles_job *j = arg;
+    for (;;) {
+	unsigned int i;
+	pthread_mutex_lock(&j->lock);
+	i = j->next++;
+	pthread_mutex_unlock(&j->lock);
+	if (i >= j->n)
+	    break;
+	j->item(j, i);
+    }
+    return NULL;
+}
+
+/*
+ * Run items [0, n) on 'nthreads' threads, each taking the next item from
+ * the queue when it finishes one
+ */
+static void
+tiles_run(struct tiles_job *j, unsigned int n, void (*item) (struct tiles_job *, unsigned int),
+    int nthreads)
+{
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    int t;
+    if (NULL == tids)
+	err(1, "calloc");
+    j->next = 0;
+    j->n = n;
+    j->item = item;
+    for (t = 0; t < nthreads; t++)
+	if (0 != pthread_create(&tids[t], NULL, tiles_thread, j))
+	    errx(1, "cannot start tile thread");
+    for (t = 0; t < nthreads; t++)
+	pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+/*
+ * Sum row 'py' of pages of level z from the two page rows below it.  Each
+ * page of level z + 1 becomes one quadrant of a page of level z.
+ */
+static void
+pool_pages(struct tiles_job *j, unsigned int py)
+{
+    const struct level *src = &j->levels[j->z + 1];
+    struct level *dst = &j->levels[j->z];
+    unsigned int size = 1U << count_page_order;
+    unsigned int half = size / 2;
+    unsigned int px;
+    for (px = 0; px < dst->n; px++) {
+	count_t *out = NULL;
+	unsigned int q;
+	for (q = 0; q < 4; q++) {
+	    const count_t *in = src->pages[(size_t) (2 * py + q / 2) * src->n + 2 * px + q % 2];
+	    count_t *o;
+	    unsigned int x;
+	    unsigned int y;
+	    if (NULL == in)
+		continue;
+	    if (NULL == out)
+		out = counts_page_alloc();
+	    o = out + (q / 2) * half * size + (q % 2) * half;
+	    for (y = 0; y < half; y++) {
+		const count_t *r0 = in + 2 * y * size;
+		const count_t *r1 = r0 + size;
+		for (x = 0; x < half; x++) {
+		    count_t c = r0[2 * x];
+		    COUNT_ADD(c, r0[2 * x + 1]);
+		    COUNT_ADD(c, r1[2 * x]);
+		    COUNT_ADD(c, r1[2 * x + 1]);
+		    o[y * size + x] = c;
+		}
+	    }
+	}
+	dst->pages[(size_t) py * dst->n + px] = out;
+    }
+}
+
+static void
+make_dir(const char *path)
+{
+    if (mkdir(path, 0777) < 0 && EEXIST != errno)
+	err(1, "%s", path);
+}
+
+/*
+ * Write tile i of level z; tiles are numbered row by row
+ */
+static void
+write_tile(struct tiles_job *j, unsigned int i)
+{
+    unsigned int size = tiles_size();
+    unsigned int page = 1U << count_page_order;
+    unsigned int k = size / page;	/* pages per tile side */
+    const struct level *l;
+    count_t *cells = NULL;
+    size_t c;
+    unsigned int tx;
+    unsigned int ty;
+    unsigned int p;
+    char path[1024];
+    int z = j->z;
+    l = &j->levels[z];
+    tx = i & ((1U << z) - 1);
+    ty = i >> z;
+    for (p = 0; p < k * k; p++) {
+	const count_t *in = l->pages[(size_t) (ty * k + p / k) * l->n + tx * k + p % k];
+	unsigned int y;
+	if (NULL == in)
+	    continue;
+	if (NULL == cells) {
+	    cells = calloc((size_t) size * size, sizeof(*cells));
+	    if (NULL == cells)
+		err(1, "calloc");
+	}
+	for (y = 0; y < page; y++)
+	    memcpy(cells + (size_t) ((p / k) * page + y) * size + (p % k) * page,
+		in + y * page, page * sizeof(*cells));
+    }
+    if (NULL == cells)
+	return;
+    for (c = 0; c < (size_t) size * size; c++)
+	if (cells[c])
+	    break;
+    if (c == (size_t) size * size) {
+	free(cells);
+	return;
+    }
+    snprintf(path, sizeof(path), "%s/%d", j->dir, z);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/%d/%u", j->dir, z, tx);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/%d/%u/%u.png", j->dir, z, tx, ty);
+    j->fn(path, cells, size, size, j->zmax - z, tx * size, ty * size);
+    free(cells);
+    pthread_mutex_lock(&j->lock);
+    j->written++;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/*
+ * Write the z/x/y.png pyramid of the paged count store under 'dir'.  Zoom
+ * 0 is a single tile of the whole map, and the deepest zoom has one count
+ * grid cell per pixel.  The count store is freed along the way.
+ */
+void
+tiles_write(const char *dir, tiles_write_fn fn, int nthreads)
+{
+    struct level levels[MAX_ZOOM + 1];
+    struct tiles_job j;
+    unsigned int written = 0;
+    int zmax = 0;
+    int z;
+    while ((tiles_size() << zmax) < count_grid_size)
+	zmax++;
+    if (zmax > MAX_ZOOM)
+	errx(1, "too many zoom levels");
+    memset(&j, 0, sizeof(j));
+    pthread_mutex_init(&j.lock, NULL);
+    j.levels = levels;
+    j.zmax = zmax;
+    j.dir = dir;
+    j.fn = fn;
+    levels[zmax].pages = count_pages;
+    levels[zmax].n = count_grid_size >> count_page_order;
+    make_dir(dir);
+    for (z = zmax; z >= 0; z--) {
+	size_t p;
+	j.z = z;
+	tiles_run(&j, 1U << (2 * z), write_tile, nthreads);
+	if (debug)
+	    fprintf(stderr, "%s: zoom %d, %u of %u tiles written\n", dir, z,
+		j.written - written, 1U << (2 * z));
+	written = j.written;
+	if (z > 0) {
+	    j.z = z - 1;
+	    levels[z - 1].n = levels[z].n / 2;
+	    levels[z - 1].pages = calloc((size_t) levels[z - 1].n * levels[z - 1].n,
+		sizeof(count_t *));
+	    if (NULL == levels[z - 1].pages)
+		err(1, "zoom level %d", z - 1);
+	    tiles_run(&j, levels[z - 1].n, pool_pages, nthreads);
+	}
+	if (z == zmax) {
+	    counts_free();
+	    continue;
+	}
+	for (p = 0; p < (size_t) levels[z].n * levels[z].n; p++)
+	    counts_page_free(levels[z].pages[p]);
+	free(levels[z].pages);
+    }
+    pthread_mutex_destroy(&j.lock);
+}
@@ -0,0 +1,22 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stddef.h>
+#include "counts.h"
+
+#define TILE_SIZE 256
+
+/*
+ * Write one tile to 'path'.  'cells' is the tile's top left cell, with rows
+ * 'stride' cells apart, and the tile is 'size' cells square.  Each cell
+ * covers (1 << shift) by (1 << shift) cells of the count grid, and the
+ * tile's top left corner is cell (x0, y0) of its zoom level.  Called from
+ * several threads at once.
+ */
+typedef void (*tiles_write_fn) (const char *path, const count_t *cells,
+    size_t stride, unsigned int size, int shift, unsigned int x0, unsigned int y0);
+
+unsigned int tiles_size(void);
+void tiles_write(const char *dir, tiles_write_fn fn, int nthreads);
+
+#endif
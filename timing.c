@@ -0,0 +1,104 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Stage timing (-X), for comparing builds.  Each line of the output is
+ *
+ *	stage	seconds	ops	ns/op	ops/sec	peak RSS (KiB)
+ *
+ * where the peak RSS is that of the process as the stage last finished.
+ * A last "total" line has the wall clock time of the whole run, the lines
+ * read, and the peak RSS at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <err.h>
+#include <pthread.h>
+
+#include <sys/resource.h>
+
+#include "timing.h"
+
+int timing_active = 0;
+
+static const char *stage_names[TIMING_STAGES] = {
+    "parse", "map", "accumulate", "colorize", "overlays", "encode"
+};
+
+static struct {
+    double secs;
+    uint64_t ops;
+    long maxrss;
+} stages[TIMING_STAGES];
+
+static double start;
+static pthread_mutex_t timing_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long
+maxrss(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+	return 0;
+    return ru.ru_maxrss;
+}
+
+double
+timing_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+timing_init(void)
+{
+    memset(stages, 0, sizeof(stages));
+    start = timing_now();
+    timing_active = 1;
+}
+
+/*
+ * Called from any thread
+ */
+void
+timing_add(int stage, double secs, uint64_t ops)
+{
+    long rss = maxrss();
+    pthread_mutex_lock(&timing_lock);
+    stages[stage].secs += secs;
+    stages[stage].ops += ops;
+    stages[stage].maxrss = rss;
+    pthread_mutex_unlock(&timing_lock);
+}
+
+static void
+timing_line(FILE *fp, const char *name, double secs, uint64_t ops, long rss)
+{
+    fprintf(fp, "%s\t%.6f\t%" PRIu64 "\t%.2f\t%.0f\t%ld\n", name, secs, ops,
+	ops ? secs * 1e9 / ops : 0.0, secs > 0.0 ? ops / secs : 0.0, rss);
+}
+
+void
+timing_write(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    int i;
+    if (NULL == fp)
+	err(1, "%s", path);
+    fprintf(fp, "stage\tsecs\tops\tns_per_op\tops_per_sec\tmaxrss_kb\n");
+    for (i = 0; i < TIMING_STAGES; i++)
+	timing_line(fp, stage_names[i], stages[i].secs, stages[i].ops, stages[i].maxrss);
+    timing_line(fp, "total", timing_now() - start, stages[TIMING_PARSE].ops, maxrss());
+    if (0 != fclose(fp))
+	err(1, "%s", path);
+}
@@ -0,0 +1,27 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+/*
+ * -X: time spent in each stage of making the map, summed over the threads
+ * that did the work, and what each stage got through.  Written out as tab
+ * separated lines once the map is done.
+ */
+enum {
+    TIMING_PARSE,		/* lines or records read */
+    TIMING_MAP,			/* addresses put on the curve */
+    TIMING_ACCUMULATE,		/* addresses added to the counts */
+    TIMING_COLORIZE,		/* pixels */
+    TIMING_OVERLAYS,		/* pixels */
+    TIMING_ENCODE,		/* pixels */
+    TIMING_STAGES
+};
+
+void timing_init(void);
+double timing_now(void);
+void timing_add(int stage, double secs, uint64_t ops);
+void timing_write(const char *path);
+extern int timing_active;
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Sliding window and decaying maps.  Input goes into a page table for the
+ * current interval, so only the pages it touches exist.
+ *
+ * With a window (-W), the intervals form a ring and the count grid holds
+ * the sum of the completed ones still in the window.  When an interval
+ * ends, its pages are added to the sum and those of the interval leaving
+ * the window are subtracted, so the work done depends on how much input
+ * those two intervals had, not on how long the feed has run.
+ *
+ * With a half-life (-H), each second's pages are folded into pages of
+ * decayed counts, and each of those keeps the time it was last brought
+ * up to date.  A page is only scaled down when something is added to it;
+ * rendering scales each page by one factor on the way out, and drops
+ * pages that have faded away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#include "ipv4-heatmap.h"
+#include "counts.h"
+#include "window.h"
+
+int window_active = 0;
+
+static struct {
+    unsigned int secs;		/* length of an interval */
+    int n;			/* intervals in the ring */
+    double halflife;		/* -H, or 0 for -W */
+    count_t ***ring;
+    int cur;
+    time_t start;		/* of the current interval */
+    float **decayed;		/* -H pages, as of epoch[] */
+    time_t *epoch;
+} w;
+
+/*
+ * Flat grid index of cell 'c' of page 'p'
+ */
+static inline size_t
+cell_index(size_t p, unsigned int c)
+{
+    int shift = count_grid_order - count_page_order;
+    size_t px = p & ((1U << shift) - 1);
+    size_t py = p >> shift;
+    unsigned int ox = c & ((1U << count_page_order) - 1);
+    unsigned int oy = c >> count_page_order;
+    return (((py << count_page_order) + oy) << count_grid_order) + (px << count_page_order) + ox;
+}
+
+/*
+ * 'secs' split into 'intervals' for -W, or a half-life of 'halflife'
+ * seconds for -H
+ */
+void
+window_init(unsigned int secs, int intervals, double halflife)
+{
+    int i;
+    memset(&w, 0, sizeof(w));
+    w.halflife = halflife;
+    if (halflife > 0) {
+	w.secs = 1;
+	w.n = 1;
+	w.decayed = calloc(counts_pages(), sizeof(*w.decayed));
+	w.epoch = calloc(counts_pages(), sizeof(*w.epoch));
+	if (NULL == w.decayed || NULL == w.epoch)
+	    err(1, "calloc");
+	counts_free();		/* the decayed pages take its place */
+    } else {
+	if ((unsigned int) intervals > secs)
+	    intervals = secs;
+	w.secs = secs / intervals;
+	w.n = intervals;
+    }
+    w.ring = calloc(w.n, sizeof(*w.ring));
+    if (NULL == w.ring)
+	err(1, "calloc");
+    for (i = 0; i < w.n; i++)
+	w.ring[i] = counts_alloc_pages();
+    w.start = time(NULL);
+    window_active = 1;
+    if (debug)
+	fprintf(stderr, "window: %d intervals of %u seconds, half-life %g\n",
+	    w.n, w.secs, w.halflife);
+}
+
+/*
+ * Fold the current interval into the decayed pages, as counts at 'now'
+ */
+static void
+decay_fold(time_t now)
+{
+    count_t **t = w.ring[w.cur];
+    size_t p;
+    unsigned int c;
+    for (p = 0; p < counts_pages(); p++) {
+	float *d;
+	if (NULL == t[p])
+	    continue;
+	d = w.decayed[p];
+	if (NULL == d) {
+	    d = w.decayed[p] = calloc(counts_page_cells(), sizeof(*d));
+	    if (NULL == d)
+		err(1, "calloc");
+	} else if (w.epoch[p] != now) {
+	    float f = exp2(-(double) (now - w.epoch[p]) / w.halflife);
+	    for (c = 0; c < counts_page_cells(); c++)
+		d[c] *= f;
+	}
+	w.epoch[p] = now;
+	for (c = 0; c < counts_page_cells(); c++)
+	    d[c] += t[p][c];
+	counts_page_free(t[p]);
+	t[p] = NULL;
+    }
+}
+
+/*
+ * Cell 'c' of page 'p' summed over the intervals in the ring but 'skip'.
+ * The grid's sum is only kept up to COUNT_MAX, so once a cell has reached
+ * it, what an interval leaving the window took away has to be worked out
+ * again from the rest.
+ */
+static count_t
+window_cell(size_t p, unsigned int c, int skip)
+{
+    count_t sum = 0;
+    int k;
+    for (k = 0; k < w.n; k++)
+	if (k != skip && w.ring[k][p])
+	    COUNT_ADD(sum, w.ring[k][p][c]);
+    return sum;
+}
+
+/*
+ * End the current interval: add it to the window, and take away the
+ * oldest one, whose table is reused for the next interval
+ */
+static void
+window_rotate(void)
+{
+    count_t **t = w.ring[w.cur];
+    size_t p;
+    unsigned int c;
+    for (p = 0; p < counts_pages(); p++) {
+	if (NULL == t[p])
+	    continue;
+	for (c = 0; c < counts_page_cells(); c++)
+	    if (t[p][c])
+		COUNT_ADD(count_grid[cell_index(p, c)], t[p][c]);
+    }
+    w.cur = (w.cur + 1) % w.n;
+    t = w.ring[w.cur];
+    for (p = 0; p < counts_pages(); p++) {
+	if (NULL == t[p])
+	    continue;
+	for (c = 0; c < counts_page_cells(); c++) {
+	    count_t *g = &count_grid[cell_index(p, c)];
+	    if (0 == t[p][c])
+		continue;
+	    if (COUNT_MAX == *g)
+		*g = window_cell(p, c, w.cur);
+	    else
+		*g -= t[p][c];
+	}
+	counts_page_free(t[p]);
+	t[p] = NULL;
+    }
+}
+
+/*
+ * Close the intervals that have ended by 'now', and return the page table
+ * that input should be painted into
+ */
+count_t **
+window_advance(time_t now)
+{
+    int k = 0;
+    if (now < w.start + (time_t) w.secs)
+	return w.ring[w.cur];
+    if (w.halflife > 0) {
+	decay_fold(w.start + w.secs);	/* however late this is */
+	w.start = now;
+	return w.ring[w.cur];
+    }
+    /* a long quiet spell just empties the window */
+    while (now >= w.start + (time_t) w.secs && k++ < w.n) {
+	window_rotate();
+	w.start += w.secs;
+    }
+    if (now >= w.start + (time_t) w.secs)
+	w.start = now - (now - w.start) % w.secs;
+    return w.ring[w.cur];
+}
+
+/*
+ * The map as of 'now' into the flat grid 'out'
+ */
+void
+window_render(count_t *out, time_t now)
+{
+    count_t **t = window_advance(now);
+    size_t p;
+    unsigned int c;
+    if (w.halflife > 0) {
+	memset(out, 0, counts_cells() * sizeof(*out));
+	for (p = 0; p < counts_pages(); p++) {
+	    float *d = w.decayed[p];
+	    float f;
+	    int live = 0;
+	    if (NULL == d)
+		continue;
+	    f = exp2(-(double) (now - w.epoch[p]) / w.halflife);
+	    for (c = 0; c < counts_page_cells(); c++) {
+		double v = d[c] * f + 0.5;
+		if (v < 1.0)
+		    continue;
+		out[cell_index(p, c)] = v > COUNT_MAX ? COUNT_MAX : (count_t) v;
+		live = 1;
+	    }
+	    if (live)
+		continue;
+	    free(d);		/* nothing left that would show */
+	    w.decayed[p] = NULL;
+	}
+    } else {
+	memcpy(out, count_grid, counts_cells() * sizeof(*out));
+    }
+    for (p = 0; p < counts_pages(); p++) {
+	if (NULL == t[p])
+	    continue;
+	for (c = 0; c < counts_page_cells(); c++)
+	    if (t[p][c])
+		COUNT_ADD(out[cell_index(p, c)], t[p][c]);
+    }
+}
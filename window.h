@@ -0,0 +1,18 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <time.h>
+#include "counts.h"
+
+/*
+ * Recent counts only, for the daemon: the sum of the last few intervals
+ * (-W), or counts that halve every so often (-H).  Input is painted into
+ * the page table window_advance() returns, and the map as of 'now' is
+ * summed by window_render().  Both are called with daemon_lock held.
+ */
+void window_init(unsigned int secs, int intervals, double halflife);
+count_t **window_advance(time_t now);
+void window_render(count_t *out, time_t now);
+extern int window_active;
+
+#endif
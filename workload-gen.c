@@ -0,0 +1,209 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Synthetic input for benchmarks.  The same options and seed always give
+ * the same lines, so runs on different builds see the same workload.
+ *
+ *	zipf	 hosts spread over the whole space, the k-th most popular
+ *		 seen in proportion to 1/k^a
+ *	cluster	 addresses in dense /24s, the /24s picked as zipf does hosts
+ *	uniform	 any address, equally likely
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <err.h>
+
+static unsigned long long rng;
+static unsigned long long rng0;	/* the seed, which also places the hosts */
+
+/*
+ * xorshift64*
+ */
+static unsigned long long
+next(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+static double
+uniform(void)
+{
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double *zipf_cdf;
+static unsigned int zipf_n;
+
+static void
+zipf_init(unsigned int n, double a)
+{
+    unsigned int k;
+    double sum = 0.0;
+    zipf_cdf = malloc(n * sizeof(*zipf_cdf));
+    if (NULL == zipf_cdf)
+	err(1, "malloc");
+    for (k = 0; k < n; k++)
+	zipf_cdf[k] = sum += pow(k + 1, -a);
+    for (k = 0; k < n; k++)
+	zipf_cdf[k] /= sum;
+    zipf_n = n;
+}
+
+/*
+ * Rank of the next zipf pick, from 0
+ */
+static unsigned int
+zipf(void)
+{
+    double u = uniform();
+    unsigned int lo = 0;
+    unsigned int hi = zipf_n - 1;
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+	if (zipf_cdf[mid] < u)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Ranks are scattered over the space by an odd multiplier, which maps
+ * distinct ranks to distinct addresses (or /24s)
+ */
+static unsigned int
+scatter(unsigned int rank, unsigned int mask)
+{
+    return ((rank + 1) * 2654435761U ^ (unsigned int) (rng0 >> 32)) & mask;
+}
+
+static int
+addr_cmp(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: workload-gen [-stv] [-a exponent] [-c clusters] [-d zipf|cluster|uniform]\n"
+	"                    [-h hosts] [-n lines] [-r lines/sec] [-S seed]\n");
+    fprintf(stderr, "\t-a exponent  zipf exponent (1.1)\n");
+    fprintf(stderr, "\t-c clusters  /24s for -d cluster (4096)\n");
+    fprintf(stderr, "\t-d dist      distribution of addresses (zipf)\n");
+    fprintf(stderr, "\t-h hosts     distinct hosts for -d zipf (1048576)\n");
+    fprintf(stderr, "\t-n lines     lines to write (1000000)\n");
+    fprintf(stderr, "\t-r rate      lines per second of -t time (10000)\n");
+    fprintf(stderr, "\t-S seed      random seed (1)\n");
+    fprintf(stderr, "\t-s           sorted by address instead of random order\n");
+    fprintf(stderr, "\t-t           timestamp first on each line\n");
+    fprintf(stderr, "\t-v           value last on each line\n");
+    exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dist = "zipf";
+    double a = 1.1;
+    unsigned int clusters = 4096;
+    unsigned int hosts = 1 << 20;
+    unsigned long n = 1000000;
+    double rate = 10000.0;
+    unsigned long long seed = 1;
+    int sorted = 0;
+    int timed = 0;
+    int values = 0;
+    unsigned int *addrs;
+    unsigned long i;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "a:c:d:h:n:r:S:stv")) != -1) {
+	switch (ch) {
+	case 'a':
+	    a = atof(optarg);
+	    break;
+	case 'c':
+	    clusters = strtoul(optarg, NULL, 10);
+	    break;
+	case 'd':
+	    dist = optarg;
+	    break;
+	case 'h':
+	    hosts = strtoul(optarg, NULL, 10);
+	    break;
+	case 'n':
+	    n = strtoul(optarg, NULL, 10);
+	    break;
+	case 'r':
+	    rate = atof(optarg);
+	    break;
+	case 'S':
+	    seed = strtoull(optarg, NULL, 10);
+	    break;
+	case 's':
+	    sorted = 1;
+	    break;
+	case 't':
+	    timed = 1;
+	    break;
+	case 'v':
+	    values = 1;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (0 == hosts || 0 == clusters || clusters > (1U << 24) || rate <= 0.0)
+	usage();
+    rng = rng0 = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    addrs = malloc(n * sizeof(*addrs));
+    if (NULL == addrs)
+	err(1, "malloc");
+    if (0 == strcmp(dist, "zipf")) {
+	zipf_init(hosts, a);
+	for (i = 0; i < n; i++)
+	    addrs[i] = scatter(zipf(), 0xFFFFFFFF);
+    } else if (0 == strcmp(dist, "cluster")) {
+	zipf_init(clusters, a);
+	for (i = 0; i < n; i++)
+	    addrs[i] = scatter(zipf(), 0xFFFFFF) << 8 | (next() >> 56);
+    } else if (0 == strcmp(dist, "uniform")) {
+	for (i = 0; i < n; i++)
+	    addrs[i] = next() >> 32;
+    } else {
+	usage();
+    }
+    if (sorted)
+	qsort(addrs, n, sizeof(*addrs), addr_cmp);
+
+    for (i = 0; i < n; i++) {
+	unsigned int x = addrs[i];
+	if (timed)
+	    printf("%.3f ", 1200000000.0 + i / rate);
+	printf("%u.%u.%u.%u", x >> 24, (x >> 16) & 0xFF, (x >> 8) & 0xFF, x & 0xFF);
+	if (values)
+	    printf(" %u", 1 + (unsigned int) (next() % 1000));
+	putchar('\n');
+    }
+    if (fflush(stdout) != 0)
+	err(1, "stdout");
+    free(addrs);
+    return 0;
+}
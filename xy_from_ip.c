@@ -18,7 +18,11 @@
 #include "cidr.h"
 #include "hilbert.h"
 
-void (*xy_from_s) (unsigned s, int n, unsigned *xp, unsigned *yp) = hil_xy_from_s;
+/*
+ * Curve kernel used for every address.  The table-driven Hilbert kernel
+ * is set up by set_order().
+ */
+void (*xy_from_s) (unsigned s, int n, unsigned *xp, unsigned *yp) = hil_xy_from_s_lut;
 
 /*
  * The default the Hilbert curve order is 12.  This gives a 4096x4096
@@ -31,6 +35,13 @@ int addr_space_bits_per_pixel = 8;	/* /24 */
 unsigned int addr_space_first_addr = 0;
 unsigned int addr_space_last_addr = ~0;
 int transpose_flag = 0;
+static int morton_mode = 0;
+
+#if HAVE_SIMD_BATCH
+static unsigned int (*xy_batch_simd) (const unsigned *, unsigned, unsigned *,
+    unsigned *, unsigned char *, const struct xy_batch_params *) = NULL;
+static struct xy_batch_params batch_params;
+#endif
 
 
 /*
@@ -56,11 +67,34 @@ xy_from_ip(unsigned ip, unsigned *xp, unsigned *yp)
     return 1;
 }
 
+/*
+ * xy_from_ip() for a block of addresses.  ok[i] is set to 1 if ips[i] is
+ * within the crop bounds, in which case xs[i] and ys[i] hold its
+ * coordinates.  Whole vectors go through the SIMD routine picked by
+ * set_order(), if any.
+ */
+void
+xy_from_ip_batch(const unsigned *ips, unsigned n, unsigned *xs, unsigned *ys, unsigned char *ok)
+{
+    unsigned int i = 0;
+#if HAVE_SIMD_BATCH
+    if (xy_batch_simd)
+	i = xy_batch_simd(ips, n, xs, ys, ok, &batch_params);
+#endif
+    for (; i < n; i++)
+	ok[i] = xy_from_ip(ips[i], &xs[i], &ys[i]);
+}
+
 
 void
 set_morton_mode()
 {
-    xy_from_s = mor_xy_from_s;
+    morton_mode = 1;
+    xy_from_s = mor_xy_from_s_magic;
+#if HAVE_BMI2_KERNELS
+    if (cpu_has_bmi2())
+	xy_from_s = mor_xy_from_s_bmi2;
+#endif
 }
 
 
@@ -79,12 +113,35 @@ int
 set_order()
 {
     hilbert_curve_order = (addr_space_bits_per_image - addr_space_bits_per_pixel) / 2;
+    hil_lut_init();
+#if HAVE_SIMD_BATCH
+    batch_params.first = addr_space_first_addr;
+    batch_params.last = addr_space_last_addr;
+    batch_params.bits_per_pixel = addr_space_bits_per_pixel;
+    batch_params.order = hilbert_curve_order;
+    batch_params.morton = morton_mode;
+    batch_params.transpose = transpose_flag;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+	xy_batch_simd = xy_batch_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+	xy_batch_simd = xy_batch_avx2;
+#endif
     if (debug) {
 	struct in_addr a;
 	char buf[20];
 	fprintf(stderr, "addr_space_bits_per_image = %d\n", addr_space_bits_per_image);
 	fprintf(stderr, "addr_space_bits_per_pixel = %d\n", addr_space_bits_per_pixel);
 	fprintf(stderr, "hilbert_curve_order = %d\n", hilbert_curve_order);
+	fprintf(stderr, "curve kernel = %s\n",
+	    xy_from_s == hil_xy_from_s_lut ? "hilbert (table)" :
+	    xy_from_s == mor_xy_from_s_magic ? "morton (portable)" :
+	    "morton (bmi2)");
+#if HAVE_SIMD_BATCH
+	fprintf(stderr, "batch kernel = %s\n",
+	    xy_batch_simd == xy_batch_avx512 ? "avx512" :
+	    xy_batch_simd == xy_batch_avx2 ? "avx2" : "scalar");
+#endif
 	a.s_addr = htonl(addr_space_first_addr);
 	inet_ntop(AF_INET, &a, buf, 20);
 	fprintf(stderr, "first_address = %s\n", buf);
@@ -8,3 +8,24 @@ extern void set_crop(const char *);
 extern void set_bits_per_pixel(int);
 extern unsigned int addr_space_first_addr;
 extern unsigned int addr_space_last_addr;
+extern int addr_space_bits_per_pixel;
+extern int transpose_flag;
+extern void xy_from_ip_batch(const unsigned *ips, unsigned n, unsigned *xs, unsigned *ys, unsigned char *ok);
+
+/*
+ * Geometry handed to the vectorized batch routines in xy_from_ip_simd.c
+ */
+struct xy_batch_params {
+    unsigned int first;
+    unsigned int last;
+    int bits_per_pixel;
+    int order;
+    int morton;
+    int transpose;
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_SIMD_BATCH 1
+extern unsigned int xy_batch_avx2(const unsigned *, unsigned, unsigned *, unsigned *, unsigned char *, const struct xy_batch_params *);
+extern unsigned int xy_batch_avx512(const unsigned *, unsigned, unsigned *, unsigned *, unsigned char *, const struct xy_batch_params *);
+#endif
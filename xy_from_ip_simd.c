@@ -0,0 +1,135 @@
+/*
+ * IPv4 Heatmap
+ * (C) 2007 The Measurement Factory, Inc
+ * Licensed under the GPL, version 2
+ * http://maps.measurement-factory.com/
+ */
+
+/*
+ * Vectorized versions of xy_from_ip() for blocks of addresses.  Each
+ * routine handles as many whole vectors as fit in 'n' and returns how many
+ * addresses it did; xy_from_ip_batch() finishes the rest.
+ *
+ * The Hilbert state machine is the same as in hilbert.c.  Its packed
+ * constant tables are indexed with variable per-lane shifts.
+ */
+
+#include "xy_from_ip.h"
+
+#if HAVE_SIMD_BATCH
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+unsigned int
+xy_batch_avx2(const unsigned *ips, unsigned n, unsigned *xs, unsigned *ys,
+    unsigned char *ok, const struct xy_batch_params *p)
+{
+    const __m256i first = _mm256_set1_epi32(p->first);
+    const __m256i last = _mm256_set1_epi32(p->last);
+    const __m128i bpp = _mm_cvtsi32_si128(p->bits_per_pixel);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i xtab = _mm256_set1_epi32(0x936C);
+    const __m256i ytab = _mm256_set1_epi32(0x39C6);
+    const __m256i stab = _mm256_set1_epi32(0x3E6B94C1);
+    unsigned int j;
+    for (j = 0; j + 8 <= n; j += 8) {
+	__m256i ip = _mm256_loadu_si256((const __m256i *)(ips + j));
+	__m256i in = _mm256_and_si256(
+	    _mm256_cmpeq_epi32(_mm256_max_epu32(ip, first), ip),
+	    _mm256_cmpeq_epi32(_mm256_min_epu32(ip, last), ip));
+	__m256i s = _mm256_srl_epi32(_mm256_sub_epi32(ip, first), bpp);
+	__m256i x = _mm256_setzero_si256();
+	__m256i y = _mm256_setzero_si256();
+	int m;
+	int i;
+	if (p->morton) {
+	    __m256i v;
+	    if (p->order < 16)
+		s = _mm256_and_si256(s, _mm256_set1_epi32((1U << (2 * p->order)) - 1));
+	    for (i = 0; i < 2; i++) {
+		v = _mm256_and_si256(i ? _mm256_srli_epi32(s, 1) : s, _mm256_set1_epi32(0x55555555));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 1)), _mm256_set1_epi32(0x33333333));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 2)), _mm256_set1_epi32(0x0F0F0F0F));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 4)), _mm256_set1_epi32(0x00FF00FF));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 8)), _mm256_set1_epi32(0x0000FFFF));
+		if (i)
+		    y = v;
+		else
+		    x = v;
+	    }
+	} else {
+	    __m256i state = _mm256_setzero_si256();
+	    for (i = 2 * p->order - 2; i >= 0; i -= 2) {
+		__m256i row = _mm256_or_si256(_mm256_slli_epi32(state, 2),
+		    _mm256_and_si256(_mm256_srl_epi32(s, _mm_cvtsi32_si128(i)), three));
+		x = _mm256_or_si256(_mm256_slli_epi32(x, 1), _mm256_and_si256(_mm256_srlv_epi32(xtab, row), one));
+		y = _mm256_or_si256(_mm256_slli_epi32(y, 1), _mm256_and_si256(_mm256_srlv_epi32(ytab, row), one));
+		state = _mm256_and_si256(_mm256_srlv_epi32(stab, _mm256_slli_epi32(row, 1)), three);
+	    }
+	}
+	_mm256_storeu_si256((__m256i *)(xs + j), p->transpose ? y : x);
+	_mm256_storeu_si256((__m256i *)(ys + j), p->transpose ? x : y);
+	m = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+	for (i = 0; i < 8; i++)
+	    ok[j + i] = (m >> i) & 1;
+    }
+    return j;
+}
+
+__attribute__((target("avx512f")))
+unsigned int
+xy_batch_avx512(const unsigned *ips, unsigned n, unsigned *xs, unsigned *ys,
+    unsigned char *ok, const struct xy_batch_params *p)
+{
+    const __m512i first = _mm512_set1_epi32(p->first);
+    const __m512i last = _mm512_set1_epi32(p->last);
+    const __m128i bpp = _mm_cvtsi32_si128(p->bits_per_pixel);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i three = _mm512_set1_epi32(3);
+    const __m512i xtab = _mm512_set1_epi32(0x936C);
+    const __m512i ytab = _mm512_set1_epi32(0x39C6);
+    const __m512i stab = _mm512_set1_epi32(0x3E6B94C1);
+    unsigned int j;
+    for (j = 0; j + 16 <= n; j += 16) {
+	__m512i ip = _mm512_loadu_si512((const void *)(ips + j));
+	__mmask16 in = _mm512_cmp_epu32_mask(ip, first, _MM_CMPINT_NLT) &
+	    _mm512_cmp_epu32_mask(ip, last, _MM_CMPINT_LE);
+	__m512i s = _mm512_srl_epi32(_mm512_sub_epi32(ip, first), bpp);
+	__m512i x = _mm512_setzero_si512();
+	__m512i y = _mm512_setzero_si512();
+	int i;
+	if (p->morton) {
+	    __m512i v;
+	    if (p->order < 16)
+		s = _mm512_and_si512(s, _mm512_set1_epi32((1U << (2 * p->order)) - 1));
+	    for (i = 0; i < 2; i++) {
+		v = _mm512_and_si512(i ? _mm512_srli_epi32(s, 1) : s, _mm512_set1_epi32(0x55555555));
+		v = _mm512_and_si512(_mm512_or_si512(v, _mm512_srli_epi32(v, 1)), _mm512_set1_epi32(0x33333333));
+		v = _mm512_and_si512(_mm512_or_si512(v, _mm512_srli_epi32(v, 2)), _mm512_set1_epi32(0x0F0F0F0F));
+		v = _mm512_and_si512(_mm512_or_si512(v, _mm512_srli_epi32(v, 4)), _mm512_set1_epi32(0x00FF00FF));
+		v = _mm512_and_si512(_mm512_or_si512(v, _mm512_srli_epi32(v, 8)), _mm512_set1_epi32(0x0000FFFF));
+		if (i)
+		    y = v;
+		else
+		    x = v;
+	    }
+	} else {
+	    __m512i state = _mm512_setzero_si512();
+	    for (i = 2 * p->order - 2; i >= 0; i -= 2) {
+		__m512i row = _mm512_or_si512(_mm512_slli_epi32(state, 2),
+		    _mm512_and_si512(_mm512_srl_epi32(s, _mm_cvtsi32_si128(i)), three));
+		x = _mm512_or_si512(_mm512_slli_epi32(x, 1), _mm512_and_si512(_mm512_srlv_epi32(xtab, row), one));
+		y = _mm512_or_si512(_mm512_slli_epi32(y, 1), _mm512_and_si512(_mm512_srlv_epi32(ytab, row), one));
+		state = _mm512_and_si512(_mm512_srlv_epi32(stab, _mm512_slli_epi32(row, 1)), three);
+	    }
+	}
+	_mm512_storeu_si512((void *)(xs + j), p->transpose ? y : x);
+	_mm512_storeu_si512((void *)(ys + j), p->transpose ? x : y);
+	for (i = 0; i < 16; i++)
+	    ok[j + i] = (in >> i) & 1;
+    }
+    return j;
+}
+
+#endif